@@ -0,0 +1,98 @@
+// Concurrent-append benchmark, like usertests' fourfiles but
+// bigger: several processes each append small writes to a file
+// of their own at the same time.  Reports the time taken and how
+// often a file's next block did not land right after its last
+// one, a measure of how fragmented the files came out.
+//
+//   appendbench [nproc [wsize]]
+//
+// Compare the default kernel, which delays block allocation,
+// with one built with DELAYBLOCKS=0.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+#include "fsstats.h"
+
+#define FILESIZE  (64*1024)  // per process; fits in one file (MAXFILE)
+
+char buf[1024];
+
+void
+fname(char *p, int i)
+{
+  p[0] = 'a';
+  p[1] = 'b';
+  p[2] = '0' + i;
+  p[3] = 0;
+}
+
+void
+appender(int id, int wsize)
+{
+  char name[4];
+  int fd, n;
+
+  fname(name, id);
+  if((fd = open(name, O_CREATE | O_RDWR)) < 0){
+    printf(1, "appendbench: create %s failed\n", name);
+    exit();
+  }
+  memset(buf, 'a' + id, wsize);
+  for(n = 0; n < FILESIZE; n += wsize){
+    if(write(fd, buf, wsize) != wsize){
+      printf(1, "appendbench: write %s failed\n", name);
+      exit();
+    }
+  }
+  close(fd);
+  exit();
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct fsstats st0, st;
+  char name[4];
+  int nproc, wsize, i, start, t, nblk;
+
+  nproc = argc > 1 ? atoi(argv[1]) : 4;
+  wsize = argc > 2 ? atoi(argv[2]) : 100;
+  if(nproc < 1 || nproc > 10 || wsize < 1 || wsize > sizeof(buf)){
+    printf(1, "usage: appendbench [nproc<=10 [wsize<=1024]]\n");
+    exit();
+  }
+  for(i = 0; i < nproc; i++){
+    fname(name, i);
+    unlink(name);
+  }
+
+  fsstats(&st0);
+  start = uptime();
+  for(i = 0; i < nproc; i++){
+    if(fork() == 0)
+      appender(i, wsize);
+  }
+  for(i = 0; i < nproc; i++)
+    wait();
+  t = uptime() - start;
+  fsstats(&st);
+
+  nblk = nproc * (((FILESIZE + wsize - 1) / wsize * wsize + 511) / 512);
+  printf(1, "appendbench: %d procs x %d KB in %d-byte writes, %d ticks",
+         nproc, FILESIZE / 1024, wsize, t);
+  if(t > 0)
+    printf(1, ", %d KB/100 ticks", nproc * FILESIZE / 1024 * 100 / t);
+  printf(1, "\n");
+  printf(1, "appendbench: %d data blocks, %d allocated late, "
+         "%d goal misses, %d commits\n",
+         nblk, st.delayed - st0.delayed, st.goalmisses - st0.goalmisses,
+         st.commits - st0.commits);
+
+  for(i = 0; i < nproc; i++){
+    fname(name, i);
+    unlink(name);
+  }
+  exit();
+}
@@ -0,0 +1,84 @@
+// Large-file benchmark: write one file of several megabytes
+// sequentially, which needs double-indirect blocks, then read
+// it back, and report the throughput of each.
+//
+//   bigbench [MB [wsize]]
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+#include "fs.h"
+#include "fsstats.h"
+
+#define FILE  "bigbench"
+
+char buf[32*1024];
+
+void
+report(char *what, int kb, int t)
+{
+  printf(1, "bigbench: %s %d KB in %d ticks", what, kb, t);
+  if(t > 0)
+    printf(1, ", %d KB/100 ticks", kb * 100 / t);
+  printf(1, "\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct fsstats st0, st;
+  int mb, wsize, fd, n, i, start, t, total;
+
+  mb = argc > 1 ? atoi(argv[1]) : 4;
+  wsize = argc > 2 ? atoi(argv[2]) : sizeof(buf);
+  if(mb < 1 || mb * 1024 * 1024 / BSIZE > MAXFILE ||
+     wsize < 1 || wsize > sizeof(buf)){
+    printf(1, "usage: bigbench [MB<=%d [wsize<=%d]]\n",
+           MAXFILE / (1024 * 1024 / BSIZE), sizeof(buf));
+    exit();
+  }
+  total = mb * 1024 * 1024;
+
+  unlink(FILE);
+  if((fd = open(FILE, O_CREATE | O_RDWR)) < 0){
+    printf(1, "bigbench: create failed\n");
+    exit();
+  }
+  fsstats(&st0);
+  start = uptime();
+  for(n = 0; n < total; n += i){
+    i = total - n < wsize ? total - n : wsize;
+    buf[0] = n / wsize;
+    if(write(fd, buf, i) != i){
+      printf(1, "bigbench: write failed at %d\n", n);
+      exit();
+    }
+  }
+  close(fd);
+  t = uptime() - start;
+  fsstats(&st);
+  report("write", total / 1024, t);
+  printf(1, "bigbench: %d commits, %d log writes, %d direct writes\n",
+         st.commits - st0.commits, st.logwrites - st0.logwrites,
+         st.directwrites - st0.directwrites);
+
+  if((fd = open(FILE, O_RDONLY)) < 0){
+    printf(1, "bigbench: open failed\n");
+    exit();
+  }
+  start = uptime();
+  for(n = 0; n < total; n += i){
+    i = total - n < wsize ? total - n : wsize;
+    if(read(fd, buf, i) != i || buf[0] != (char)(n / wsize)){
+      printf(1, "bigbench: read failed at %d\n", n);
+      exit();
+    }
+  }
+  close(fd);
+  t = uptime() - start;
+  report("read", total / 1024, t);
+
+  unlink(FILE);
+  exit();
+}
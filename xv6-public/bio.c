@@ -17,6 +17,11 @@
 // * B_VALID: the buffer data has been read from the disk.
 // * B_DIRTY: the buffer data has been modified
 //     and needs to be written to disk.
+//
+// A third, B_DELAY, marks a buffer holding file data that has
+// no disk block yet (see writeidelay() in fs.c).  Such a buffer
+// is named by inode and block number in the file, is found only
+// by bdget(), and stays in the cache until bdrop().
 
 #include "types.h"
 #include "defs.h"
@@ -25,6 +30,7 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "fsstats.h"
 
 struct {
   struct spinlock lock;
@@ -33,6 +39,7 @@ struct {
   // Linked list of all buffers, through prev/next.
   // head.next is most recently used.
   struct buf head;
+  int ndelay;  // B_DELAY buffers
 } bcache;
 
 void
@@ -67,7 +74,7 @@ bget(uint dev, uint blockno)
 
   // Is the block already cached?
   for(b = bcache.head.next; b != &bcache.head; b = b->next){
-    if(b->dev == dev && b->blockno == blockno){
+    if(b->dev == dev && b->blockno == blockno && (b->flags & B_DELAY) == 0){
       b->refcnt++;
       release(&bcache.lock);
       acquiresleep(&b->lock);
@@ -76,10 +83,10 @@ bget(uint dev, uint blockno)
   }
 
   // Not cached; recycle an unused buffer.
-  // Even if refcnt==0, B_DIRTY indicates a buffer is in use
-  // because log.c has modified it but not yet committed it.
+  // Blocks modified by log.c but not yet installed are pinned
+  // with a reference, so they are never picked here.
   for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if(b->refcnt == 0 && (b->flags & B_DIRTY) == 0) {
+    if(b->refcnt == 0 && (b->flags & (B_DIRTY|B_DELAY)) == 0) {
       b->dev = dev;
       b->blockno = blockno;
       b->flags = 0;
@@ -92,19 +99,99 @@ bget(uint dev, uint blockno)
   panic("bget: no buffers");
 }
 
+// Return the locked B_DELAY buffer for block lbn of inode inum.
+// If there is none and create is set, make one, filled with
+// zeros.  Returns 0 if there is none or NDELAY are in use.
+struct buf*
+bdget(uint dev, uint inum, uint lbn, int create)
+{
+  struct buf *b;
+
+  acquire(&bcache.lock);
+  for(b = bcache.head.next; b != &bcache.head; b = b->next){
+    if((b->flags & B_DELAY) && b->dev == dev && b->inum == inum &&
+       b->blockno == lbn){
+      b->refcnt++;
+      release(&bcache.lock);
+      acquiresleep(&b->lock);
+      return b;
+    }
+  }
+  if(!create || bcache.ndelay >= NDELAY){
+    release(&bcache.lock);
+    return 0;
+  }
+  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
+    if(b->refcnt == 0 && (b->flags & (B_DIRTY|B_DELAY)) == 0) {
+      b->dev = dev;
+      b->blockno = lbn;
+      b->inum = inum;
+      b->flags = B_VALID | B_DELAY;
+      b->refcnt = 1;
+      bcache.ndelay++;
+      release(&bcache.lock);
+      acquiresleep(&b->lock);
+      memset(b->data, 0, BSIZE);
+      return b;
+    }
+  }
+  release(&bcache.lock);
+  return 0;
+}
+
+// Release locked B_DELAY buffer b for good: its data has been
+// copied to a disk block, or its file truncated.
+void
+bdrop(struct buf *b)
+{
+  if(!holdingsleep(&b->lock) || (b->flags & B_DELAY) == 0)
+    panic("bdrop");
+  acquire(&bcache.lock);
+  b->flags = 0;
+  bcache.ndelay--;
+  release(&bcache.lock);
+  brelse(b);
+}
+
+// Sync b with its disk through whichever driver serves it.
+// The file system disk is the virtio-blk device when QEMU
+// provides one; everything else goes to the IDE driver.
+void
+diskrw(struct buf *b)
+{
+  if(havevirtio && b->dev == ROOTDEV)
+    virtiorw(b);
+  else
+    iderw(b);
+}
+
 // Return a locked buf with the contents of the indicated block.
 struct buf*
 bread(uint dev, uint blockno)
 {
   struct buf *b;
 
+  fsstats.breads++;
   b = bget(dev, blockno);
   if((b->flags & B_VALID) == 0) {
-    iderw(b);
+    diskrw(b);
   }
   return b;
 }
 
+// Return a locked buf for the indicated block, filled with
+// zeros without reading the disk. For freshly allocated blocks.
+struct buf*
+bzget(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  b = bget(dev, blockno);
+  memset(b->data, 0, BSIZE);
+  b->flags |= B_VALID;
+  return b;
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
@@ -112,7 +199,25 @@ bwrite(struct buf *b)
   if(!holdingsleep(&b->lock))
     panic("bwrite");
   b->flags |= B_DIRTY;
-  iderw(b);
+  diskrw(b);
+}
+
+// Keep b in the cache even after brelse(): the log holds
+// a reference until the block is installed at home.
+void
+bpin(struct buf *b)
+{
+  acquire(&bcache.lock);
+  b->refcnt++;
+  release(&bcache.lock);
+}
+
+void
+bunpin(struct buf *b)
+{
+  acquire(&bcache.lock);
+  b->refcnt--;
+  release(&bcache.lock);
 }
 
 // Release a locked buffer.
@@ -1,7 +1,8 @@
 struct buf {
   int flags;
   uint dev;
-  uint blockno;
+  uint blockno;      // for B_DELAY, the block's number in its file
+  uint inum;         // for B_DELAY, the file's inode
   struct sleeplock lock;
   uint refcnt;
   struct buf *prev; // LRU cache list
@@ -11,4 +12,5 @@ struct buf {
 };
 #define B_VALID 0x2  // buffer has been read from disk
 #define B_DIRTY 0x4  // buffer needs to be written to disk
+#define B_DELAY 0x8  // file data with no disk block yet
 
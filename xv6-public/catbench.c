@@ -0,0 +1,77 @@
+// Concurrent-reader benchmark: 1 to nproc processes each read
+// the same file from start to end, like cat, several times.
+// The file fits in the buffer cache, so the readers compete only
+// for the CPU and the file's inode lock; with readers sharing
+// that lock the total rate should grow with the number of CPUs.
+//
+//   catbench [nproc [passes]]
+//
+// Run under "make qemu CPUS=4".
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+
+#define NBLK  128   // file size in 512-byte blocks; less than NBUF
+
+char buf[512];
+char *file = "catbench.f";
+
+void
+reader(int passes)
+{
+  int i, fd;
+
+  for(i = 0; i < passes; i++){
+    if((fd = open(file, O_RDONLY)) < 0){
+      printf(1, "catbench: open failed\n");
+      exit();
+    }
+    while(read(fd, buf, sizeof(buf)) > 0)
+      ;
+    close(fd);
+  }
+  exit();
+}
+
+int
+main(int argc, char *argv[])
+{
+  int nproc, passes, n, i, fd, start, t, kb;
+
+  nproc = argc > 1 ? atoi(argv[1]) : 4;
+  passes = argc > 2 ? atoi(argv[2]) : 50;
+
+  if((fd = open(file, O_CREATE | O_RDWR)) < 0){
+    printf(1, "catbench: create failed\n");
+    exit();
+  }
+  memset(buf, 'c', sizeof(buf));
+  for(i = 0; i < NBLK; i++){
+    if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+      printf(1, "catbench: write failed\n");
+      exit();
+    }
+  }
+  close(fd);
+
+  for(n = 1; n <= nproc; n++){
+    start = uptime();
+    for(i = 0; i < n; i++){
+      if(fork() == 0)
+        reader(passes);
+    }
+    for(i = 0; i < n; i++)
+      wait();
+    t = uptime() - start;
+    kb = n * passes * NBLK / 2;
+    printf(1, "catbench: %d readers, %d KB in %d ticks", n, kb, t);
+    if(t > 0)
+      printf(1, ", %d KB/100 ticks", kb * 100 / t);
+    printf(1, "\n");
+  }
+
+  unlink(file);
+  exit();
+}
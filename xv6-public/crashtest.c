@@ -0,0 +1,145 @@
+// Crash-recovery test, mainly for asynchronous commit.
+//
+//   crashtest w   write files slowly, calling sync() now and then
+//   crashtest c   check them after a crash
+//
+// Build with "make clean; make qemu COMMITTICKS=100", run
+// "crashtest w", and kill QEMU from another terminal while it
+// is running, between two of its "synced" lines. Boot the same
+// fs.img again (recovery runs at boot) and run "crashtest c".
+// Files covered by a sync() that returned must be complete;
+// any other may be missing or short, but must not hold wrong
+// data.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+
+#define NFILES  40
+#define NWRITE  4     // writes per file
+#define WSIZE   512
+
+char buf[WSIZE];
+char *countfile = "ctsynced";
+
+void
+fname(char *p, int i)
+{
+  p[0] = 'c';
+  p[1] = 't';
+  p[2] = '0' + i/10;
+  p[3] = '0' + i%10;
+  p[4] = 0;
+}
+
+// Byte k of file i.
+char
+pattern(int i, int k)
+{
+  return 'a' + (i + k/WSIZE) % 26;
+}
+
+void
+writer(void)
+{
+  char name[5];
+  int i, j, k, fd;
+
+  unlink(countfile);
+  for(i = 0; i < NFILES; i++){
+    fname(name, i);
+    unlink(name);
+  }
+  sync();
+
+  for(i = 0; i < NFILES; i++){
+    fname(name, i);
+    if((fd = open(name, O_CREATE | O_RDWR)) < 0){
+      printf(1, "crashtest: create %s failed\n", name);
+      exit();
+    }
+    for(j = 0; j < NWRITE; j++){
+      for(k = 0; k < WSIZE; k++)
+        buf[k] = pattern(i, j*WSIZE + k);
+      if(write(fd, buf, WSIZE) != WSIZE){
+        printf(1, "crashtest: write %s failed\n", name);
+        exit();
+      }
+      sleep(5);
+    }
+    close(fd);
+
+    if(i % 2 == 1){
+      // Record how many files are complete, then make it durable.
+      if((fd = open(countfile, O_CREATE | O_RDWR)) < 0){
+        printf(1, "crashtest: create %s failed\n", countfile);
+        exit();
+      }
+      j = i + 1;
+      write(fd, &j, sizeof(j));
+      close(fd);
+      if(sync() < 0){
+        printf(1, "crashtest: sync failed\n");
+        exit();
+      }
+      printf(1, "synced %d files\n", j);
+    }
+  }
+  printf(1, "crashtest: done writing\n");
+}
+
+void
+checker(void)
+{
+  char name[5];
+  int i, k, n, fd, nsynced, size, bad;
+
+  nsynced = 0;
+  if((fd = open(countfile, O_RDONLY)) >= 0){
+    if(read(fd, &nsynced, sizeof(nsynced)) != sizeof(nsynced))
+      nsynced = 0;
+    close(fd);
+  }
+
+  bad = 0;
+  for(i = 0; i < NFILES; i++){
+    fname(name, i);
+    if((fd = open(name, O_RDONLY)) < 0){
+      if(i < nsynced){
+        printf(1, "crashtest: synced file %s missing\n", name);
+        bad = 1;
+      }
+      continue;
+    }
+    size = 0;
+    while((n = read(fd, buf, WSIZE)) > 0){
+      for(k = 0; k < n; k++){
+        if(buf[k] != pattern(i, size + k)){
+          printf(1, "crashtest: %s wrong data at %d\n", name, size + k);
+          bad = 1;
+          break;
+        }
+      }
+      size += n;
+    }
+    close(fd);
+    if(i < nsynced && size != NWRITE*WSIZE){
+      printf(1, "crashtest: synced file %s has %d bytes\n", name, size);
+      bad = 1;
+    }
+  }
+  printf(1, "crashtest: %d files synced, %s\n", nsynced, bad ? "FAILED" : "ok");
+}
+
+int
+main(int argc, char *argv[])
+{
+  if(argc == 2 && strcmp(argv[1], "w") == 0)
+    writer();
+  else if(argc == 2 && strcmp(argv[1], "c") == 0)
+    checker();
+  else
+    printf(1, "usage: crashtest w|c\n");
+  exit();
+}
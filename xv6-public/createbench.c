@@ -0,0 +1,110 @@
+// Small-file creation benchmark: several processes each
+// create, write, close and chmod many small files at once, so
+// their file system calls pile up behind log commits.
+// With -t each file's calls are one user transaction
+// (fs_txn_begin/fs_txn_end), so they commit together.
+//
+//   createbench [-t] [nproc [nfiles]]
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+#include "fs.h"
+#include "fsstats.h"
+
+char data[32];
+int txn;
+
+void
+fname(char *p, int id, int i)
+{
+  p[0] = 'c';
+  p[1] = 'a' + id;
+  p[2] = '0' + i/100;
+  p[3] = '0' + (i/10)%10;
+  p[4] = '0' + i%10;
+  p[5] = 0;
+}
+
+void
+creator(int id, int n)
+{
+  char name[6];
+  int i, fd;
+
+  for(i = 0; i < n; i++){
+    fname(name, id, i);
+    if(txn && fs_txn_begin() < 0){
+      printf(1, "createbench: fs_txn_begin failed\n");
+      exit();
+    }
+    if((fd = open(name, O_CREATE | O_RDWR)) < 0){
+      printf(1, "createbench: create %s failed\n", name);
+      exit();
+    }
+    if(write(fd, data, sizeof(data)) != sizeof(data)){
+      printf(1, "createbench: write %s failed\n", name);
+      exit();
+    }
+    close(fd);
+    chmod(name, MODE_RUSR | MODE_WUSR | MODE_ROTH);
+    if(txn && fs_txn_end() < 0)
+      printf(1, "createbench: %s committed in parts\n", name);
+  }
+  exit();
+}
+
+int
+main(int argc, char *argv[])
+{
+  char name[6];
+  int nproc, nfile, id, i, start, t, commits;
+  struct fsstats st0, st;
+
+  if(argc > 1 && strcmp(argv[1], "-t") == 0){
+    txn = 1;
+    argc--;
+    argv++;
+  }
+  nproc = argc > 1 ? atoi(argv[1]) : 4;
+  nfile = argc > 2 ? atoi(argv[2]) : 25;
+  if(nproc < 1 || nproc > 26 || nfile < 1 || nfile > 999){
+    printf(1, "usage: createbench [-t] [nproc<=26 [nfiles<=999]]\n");
+    exit();
+  }
+  memset(data, 'c', sizeof(data));
+
+  fsstats(&st0);
+  start = uptime();
+  for(id = 0; id < nproc; id++){
+    if(fork() == 0)
+      creator(id, nfile);
+  }
+  for(id = 0; id < nproc; id++)
+    wait();
+  t = uptime() - start;
+  fsstats(&st);
+  commits = st.commits - st0.commits;
+
+  printf(1, "createbench%s: %d procs x %d files in %d ticks, %d commits",
+         txn ? " -t" : "", nproc, nfile, t, commits);
+  if(t > 0)
+    printf(1, ", %d creates/100 ticks, %d commits/100 ticks",
+           nproc * nfile * 100 / t, commits * 100 / t);
+  printf(1, "\n");
+  printf(1, "createbench: %d inodes allocated, %d inode blocks read\n",
+         st.iallocs - st0.iallocs, st.iscans - st0.iscans);
+  printf(1, "createbench: %d breads, %d inode write-backs, "
+         "%d.%d breads per file\n",
+         st.breads - st0.breads, st.iwrites - st0.iwrites,
+         (st.breads - st0.breads) / (nproc * nfile),
+         (st.breads - st0.breads) * 10 / (nproc * nfile) % 10);
+
+  for(id = 0; id < nproc; id++)
+    for(i = 0; i < nfile; i++){
+      fname(name, id, i);
+      unlink(name);
+    }
+  exit();
+}
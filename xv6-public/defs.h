@@ -1,7 +1,10 @@
 struct buf;
 struct context;
+struct direntplus;
 struct file;
+struct fsstats;
 struct inode;
+struct pcidev;
 struct pipe;
 struct proc;
 struct rtcdate;
@@ -13,8 +16,14 @@ struct superblock;
 // bio.c
 void            binit(void);
 struct buf*     bread(uint, uint);
+struct buf*     bzget(uint, uint);
+struct buf*     bdget(uint, uint, uint, int);
+void            bdrop(struct buf*);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
+void            bpin(struct buf*);
+void            bunpin(struct buf*);
+void            diskrw(struct buf*);
 
 // console.c
 void            consoleinit(void);
@@ -38,20 +47,32 @@ int             filewrite(struct file*, char*, int n);
 void            readsb(int dev, struct superblock *sb);
 int             dirlink(struct inode*, char*, uint);
 struct inode*   dirlookup(struct inode*, char*, uint*);
-struct inode*   ialloc(uint, short);
+struct inode*   ialloc(uint, short, uint);
 struct inode*   idup(struct inode*);
 void            iinit(int dev);
+void            bsuminit(int dev);
+void            isuminit(int dev);
 void            ilock(struct inode*);
+void            ilockshared(struct inode*);
 void            iput(struct inode*);
 void            iunlock(struct inode*);
 void            iunlockput(struct inode*);
 void            iupdate(struct inode*);
+void            iupdatedone(void);
+void            dirmaintain(void);
+void            dcupdate(struct inode*, char*, uint);
+int             dirlist(struct inode*, uint*, struct direntplus*, int, int);
 int             namecmp(const char*, const char*);
 struct inode*   namei(char*);
 struct inode*   nameiparent(char*, char*);
 int             readi(struct inode*, char*, uint, uint);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, char*, uint, uint);
+int             writeidirect(struct inode*, char*, uint, uint, int);
+int             writeidelay(struct inode*, char*, uint, uint);
+int             idelayflush(struct inode*, int);
+void            idelaysync(struct inode*);
+void            idelaysyncall(void);
 
 int             has_own(struct inode*);
 int             has_read_permission(struct inode*);
@@ -65,6 +86,7 @@ void            iderw(struct buf*);
 
 // ioapic.c
 void            ioapicenable(int irq, int cpu);
+void            ioapicenablepci(int irq, int cpu);
 extern uchar    ioapicid;
 void            ioapicinit(void);
 
@@ -89,13 +111,28 @@ void            microdelay(int);
 // log.c
 void            initlog(int dev);
 void            log_write(struct buf*);
-void            begin_op();
+void            log_write_range(struct buf*, uint, uint);
+void            log_freed(uint);
+int             log_holds(uint);
+int             txn_begin(void);
+int             log_sync(void);
+int             txn_end(void);
+void            begin_op(int);
 void            end_op();
+extern struct fsstats fsstats;
 
 // mp.c
 extern int      ismp;
 void            mpinit(void);
 
+// pci.c
+void            pciinit(void);
+struct pcidev*  pcifind(int, int);
+struct pcidev*  pcifindclass(int, int);
+uint            pciconfread(struct pcidev*, int);
+void            pciconfwrite(struct pcidev*, int, uint);
+void            pcienable(struct pcidev*);
+
 // picirq.c
 void            picenable(int);
 void            picinit(void);
@@ -113,6 +150,7 @@ void            exit(void);
 int             fork(void);
 int             growproc(int);
 int             kill(int);
+void            kthread(char*, void(*)(void));
 struct cpu*     mycpu(void);
 struct proc*    myproc();
 void            pinit(void);
@@ -142,8 +180,10 @@ void            popcli(void);
 
 // sleeplock.c
 void            acquiresleep(struct sleeplock*);
+void            acquiresleepshared(struct sleeplock*);
 void            releasesleep(struct sleeplock*);
 int             holdingsleep(struct sleeplock*);
+int             holdingsleepany(struct sleeplock*);
 void            initsleeplock(struct sleeplock*, char*);
 
 // string.c
@@ -177,6 +217,12 @@ void            uartinit(void);
 void            uartintr(void);
 void            uartputc(int);
 
+// virtio.c
+extern int      havevirtio;
+void            virtioinit(void);
+int             virtiointr(int);
+void            virtiorw(struct buf*);
+
 // vm.c
 void            seginit(void);
 void            kvmalloc(void);
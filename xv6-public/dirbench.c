@@ -0,0 +1,113 @@
+// Directory benchmark: give one file n names in a new
+// directory, look each name up, then remove them all, and
+// report the ticks and directory blocks read for each phase.
+// Build with DIRHASH=0 to compare with linear directories.
+//
+//   dirbench [n]
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+#include "fs.h"
+#include "fsstats.h"
+
+#define DIR "dirbench.d"
+
+void
+fname(char *p, int i)
+{
+  p[0] = 'n';
+  p[1] = '0' + i/10000;
+  p[2] = '0' + (i/1000)%10;
+  p[3] = '0' + (i/100)%10;
+  p[4] = '0' + (i/10)%10;
+  p[5] = '0' + i%10;
+  p[6] = 0;
+}
+
+int start;
+struct fsstats st0;
+
+void
+begin(void)
+{
+  fsstats(&st0);
+  start = uptime();
+}
+
+void
+report(char *what, int n)
+{
+  struct fsstats st;
+  int t;
+
+  t = uptime() - start;
+  fsstats(&st);
+  printf(1, "dirbench: %d %s in %d ticks, %d dir blocks read, "
+         "%d.%d per name\n", n, what, t, st.dirblocks - st0.dirblocks,
+         (st.dirblocks - st0.dirblocks) / n,
+         (st.dirblocks - st0.dirblocks) * 10 / n % 10);
+}
+
+int
+main(int argc, char *argv[])
+{
+  char name[7];
+  int n, i, fd;
+  struct fsstats st;
+
+  n = argc > 1 ? atoi(argv[1]) : 10000;
+  if(n < 1 || n > 30000){
+    printf(1, "usage: dirbench [n<=30000]\n");
+    exit();
+  }
+
+  if(mkdir(DIR) < 0 || chdir(DIR) < 0){
+    printf(1, "dirbench: cannot make %s\n", DIR);
+    exit();
+  }
+  if((fd = open("f", O_CREATE | O_RDWR)) < 0){
+    printf(1, "dirbench: create failed\n");
+    exit();
+  }
+  close(fd);
+
+  begin();
+  for(i = 0; i < n; i++){
+    fname(name, i);
+    if(link("f", name) < 0){
+      printf(1, "dirbench: link %s failed\n", name);
+      exit();
+    }
+  }
+  report("links", n);
+  fsstats(&st);
+  printf(1, "dirbench: %d bucket splits\n", st.dirsplits - st0.dirsplits);
+
+  begin();
+  for(i = 0; i < n; i++){
+    fname(name, (i * 7919) % n);
+    if((fd = open(name, O_RDONLY)) < 0){
+      printf(1, "dirbench: open %s failed\n", name);
+      exit();
+    }
+    close(fd);
+  }
+  report("lookups", n);
+
+  begin();
+  for(i = 0; i < n; i++){
+    fname(name, i);
+    if(unlink(name) < 0){
+      printf(1, "dirbench: unlink %s failed\n", name);
+      exit();
+    }
+  }
+  report("unlinks", n);
+
+  unlink("f");
+  chdir("..");
+  unlink(DIR);
+  exit();
+}
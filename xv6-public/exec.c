@@ -19,14 +19,14 @@ exec(char *path, char **argv)
   pde_t *pgdir, *oldpgdir;
   struct proc *curproc = myproc();
 
-  begin_op();
+  begin_op(0);
 
   if((ip = namei(path)) == 0){
     end_op();
     cprintf("exec: fail\n");
     return -1;
   }
-  ilock(ip);
+  ilockshared(ip);
 
   pgdir = 0;
 
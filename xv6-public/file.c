@@ -5,6 +5,7 @@
 #include "types.h"
 #include "defs.h"
 #include "param.h"
+#include "stat.h"
 #include "fs.h"
 #include "spinlock.h"
 #include "sleeplock.h"
@@ -73,7 +74,15 @@ fileclose(struct file *f)
   if(ff.type == FD_PIPE)
     pipeclose(ff.pipe, ff.writable);
   else if(ff.type == FD_INODE){
-    begin_op();
+    // Give blocks written through this file disk blocks now,
+    // while the caller can still reserve log space for them.
+    if(ff.writable && ff.ip->type == T_FILE){
+      begin_op(INDBLOCKS + DELAYBLOCKS);
+      ilock(ff.ip);
+      idelayflush(ff.ip, DELAYBLOCKS);
+      iunlock(ff.ip);
+    } else
+      begin_op(0);
     iput(ff.ip);
     end_op();
   }
@@ -84,7 +93,7 @@ int
 filestat(struct file *f, struct stat *st)
 {
   if(f->type == FD_INODE){
-    ilock(f->ip);
+    ilockshared(f->ip);
     stati(f->ip, st);
     iunlock(f->ip);
     return 0;
@@ -103,7 +112,12 @@ fileread(struct file *f, char *addr, int n)
   if(f->type == FD_PIPE)
     return piperead(f->pipe, addr, n);
   if(f->type == FD_INODE){
-    ilock(f->ip);
+    // Readers of one inode may share its lock, unless they also
+    // share f, whose offset the inode lock then protects.
+    if(f->ref > 1)
+      ilock(f->ip);
+    else
+      ilockshared(f->ip);
     if((r = readi(f->ip, addr, f->off, n)) > 0)
       f->off += r;
     iunlock(f->ip);
@@ -126,29 +140,53 @@ filewrite(struct file *f, char *addr, int n)
   if(f->type == FD_INODE){
     // write a few blocks at a time to avoid exceeding
     // the maximum log transaction size, including
-    // i-node, indirect block, allocation blocks,
+    // i-node, indirect blocks, allocation blocks,
     // and 2 blocks of slop for non-aligned writes.
     // this really belongs lower down, since writei()
     // might be writing a device like the console.
-    int max = ((MAXOPBLOCKS-1-1-2) / 2) * 512;
+    int max = ((MAXOPBLOCKS-1-INDBLOCKS-2) / 2) * BSIZE;
     int i = 0;
     while(i < n){
       int n1 = n - i;
-      if(n1 > max)
-        n1 = max;
-
-      begin_op();
+      if(n1 > max){
+        // Large write: stream the data blocks straight to
+        // disk, many per transaction, and log only the
+        // metadata. Reserve the indirect blocks and the blocks
+        // writeidirect() may have to log; begin_op() already
+        // allows for the i-node and every bitmap block, for
+        // the iput() this operation does not do.
+        if(n1 > STREAMBLOCKS*BSIZE)
+          n1 = STREAMBLOCKS*BSIZE;
+        begin_op(INDBLOCKS + STREAMLOGGED);
+        ilock(f->ip);
+        if ((r = writeidirect(f->ip, addr + i, f->off, n1, STREAMLOGGED)) > 0)
+          f->off += r;
+        iunlock(f->ip);
+        end_op();
+
+        if(r <= 0){
+          r = -1;
+          break;
+        }
+        i += r;
+        continue;
+      }
+      // blocks n1 bytes can touch, each with a bitmap block,
+      // plus the i-node and the indirect blocks.
+      int nb = (n1 + 2*BSIZE - 2) / BSIZE;
+
+      begin_op(2*nb + 1 + INDBLOCKS);
       ilock(f->ip);
-      if ((r = writei(f->ip, addr + i, f->off, n1)) > 0)
+      if ((r = writeidelay(f->ip, addr + i, f->off, n1)) > 0)
         f->off += r;
       iunlock(f->ip);
       end_op();
 
       if(r < 0)
         break;
-      if(r != n1)
-        panic("short filewrite");
       i += r;
+      if(r != n1)
+        break;  // the file ran out of extents
     }
     return i == n ? n : -1;
   }
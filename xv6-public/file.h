@@ -14,8 +14,13 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  uint seq;           // odd while locked exclusively; see namefast()
+  struct inode *hnext;  // next in hash chain
+  struct inode *prev;   // LRU list of unreferenced inodes
+  struct inode *next;
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
+  int dirty;          // changed since last written to its block?
 
   char perm;          // copy of disk inode
   char type;
@@ -23,8 +28,16 @@ struct inode {
   short minor;
   short nlink;
   uint size;
-  uint addrs[NDIRECT+1];
+  uint addrs[NDIRECT+2];
   uint owner;
+
+  uint goal;          // where to allocate the next block; 0 if unknown
+  uint ndelay;        // blocks in B_DELAY buffers, not yet allocated
+  uint dfirst;        // lowest such block, if ndelay > 0
+  uint dresv;         // free blocks promised to them (see breserve())
+  int dflush;         // idelayflush() may allocate from dresv
+  struct extent ext;  // last extent used, if ext.len > 0
+  uint extat;         // where it is kept (see emap())
 };
 
 // table mapping major device number to
@@ -20,9 +20,12 @@
 #include "fs.h"
 #include "buf.h"
 #include "file.h"
+#include "fsstats.h"
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 static void itrunc(struct inode*);
+static void dcinit(void);
+static void dcforget(struct inode*);
 int has_read_permission(struct inode*);
 int has_write_permission(struct inode*);
 int has_execute_permission(struct inode*);
@@ -48,37 +51,266 @@ bzero(int dev, int bno)
 {
   struct buf *bp;
 
-  bp = bread(dev, bno);
-  memset(bp->data, 0, BSIZE);
+  bp = bzget(dev, bno);
   log_write(bp);
   brelse(bp);
 }
 
 // Blocks.
+//
+// The allocator keeps a summary of the free-block bitmap in
+// memory: for each bitmap block, how many blocks it still has
+// free and the lowest bit that might be free.  Allocation starts
+// at a goal (the block after the file's previous one) or else at
+// a rotating cursor, skips bitmap blocks with nothing free and
+// bytes with all bits set, so it rarely looks at more than one
+// bitmap block.  The summary entries for a bitmap block change
+// only while its buffer is locked; the cursor is just a hint.
+//
+// An allocation first claims its blocks from a count of all
+// free blocks, so the bitmap is sure to have them.  Part of the
+// count is promised to delayed blocks (see idelaybuf()), and
+// only the flush of the inode they belong to may claim that.
+
+static struct {
+  uint nbmap;           // bitmap blocks in use
+  uint cursor;          // where the next allocation without a goal starts
+  ushort nfree[NBMAP];  // free blocks per bitmap block
+  ushort hint[NBMAP];   // no free bit below this one
+  struct spinlock lock; // protects the counts below
+  uint free;            // free blocks on the disk
+  uint resv;            // of which are promised to delayed blocks
+} bsum;
+
+// Number of blocks described by bitmap block i.
+static uint
+bmapbits(uint i)
+{
+  return min(BPB, sb.size - i*BPB);
+}
+
+// Build the summary from the bitmap on disk.
+// Called once, after log recovery.
+void
+bsuminit(int dev)
+{
+  struct buf *bp;
+  uint i, bi, lim;
+
+  initlock(&bsum.lock, "bsum");
+  bsum.nbmap = (sb.size + BPB - 1) / BPB;
+  if(bsum.nbmap > NBMAP)
+    panic("bsuminit: bitmap too big");
+  bsum.free = bsum.resv = 0;
+  for(i = 0; i < bsum.nbmap; i++){
+    bp = bread(dev, sb.bmapstart + i);
+    lim = bmapbits(i);
+    bsum.nfree[i] = 0;
+    bsum.hint[i] = lim;
+    for(bi = 0; bi < lim; bi++){
+      if((bp->data[bi/8] & (1 << (bi % 8))) == 0){
+        if(bsum.nfree[i]++ == 0)
+          bsum.hint[i] = bi;
+      }
+    }
+    brelse(bp);
+    bsum.free += bsum.nfree[i];
+  }
+  bsum.cursor = 0;
+}
+
+// Claim up to n free blocks for an allocation and return how
+// many.  While ip is flushing its delayed blocks it may also
+// claim the blocks promised to them.
+// Caller must hold ip->lock, if ip is not 0.
+static uint
+bclaim(struct inode *ip, uint n)
+{
+  uint mine, avail;
+
+  mine = ip && ip->dflush ? ip->dresv : 0;
+  acquire(&bsum.lock);
+  avail = bsum.free - bsum.resv + mine;
+  if(n > avail)
+    n = avail;
+  mine = min(n, mine);
+  bsum.free -= n;
+  bsum.resv -= mine;
+  release(&bsum.lock);
+  if(mine)
+    ip->dresv -= mine;
+  return n;
+}
+
+// Are all free blocks promised to delayed blocks?  A hint:
+// the answer may change as soon as it is given.
+static int
+bfull(void)
+{
+  return bsum.free == bsum.resv;
+}
+
+// Give back n claimed blocks that were not allocated.
+static void
+bunclaim(struct inode *ip, uint n)
+{
+  acquire(&bsum.lock);
+  bsum.free += n;
+  if(ip && ip->dflush){
+    bsum.resv += n;
+    ip->dresv += n;
+  }
+  release(&bsum.lock);
+}
+
+// Promise n free blocks to ip's delayed blocks.
+// Returns -1 if there are not that many.
+// Caller must hold ip->lock.
+static int
+breserve(struct inode *ip, uint n)
+{
+  int r;
+
+  acquire(&bsum.lock);
+  r = -1;
+  if(bsum.free - bsum.resv >= n){
+    bsum.resv += n;
+    ip->dresv += n;
+    r = 0;
+  }
+  release(&bsum.lock);
+  return r;
+}
+
+// Take back what is still promised to ip's delayed blocks.
+// Caller must hold ip->lock.
+static void
+bunreserve(struct inode *ip)
+{
+  acquire(&bsum.lock);
+  bsum.resv -= ip->dresv;
+  release(&bsum.lock);
+  ip->dresv = 0;
+}
+
+// Find a clear bit in map between bit from and bit lim.
+// Returns -1 if there is none.
+static int
+bscan(uchar *map, uint from, uint lim)
+{
+  uint bi;
+
+  for(bi = from; bi < lim; bi++){
+    if(bi % 8 == 0){
+      while(bi + 8 <= lim && map[bi/8] == 0xff)
+        bi += 8;
+      if(bi >= lim)
+        break;
+    }
+    if((map[bi/8] & (1 << (bi % 8))) == 0)
+      return bi;
+  }
+  return -1;
+}
+
+// Find a clear bit in bitmap block i between bit from and bit
+// lim.  If avoid is set, pass over blocks the log still holds,
+// giving up after a few.  Returns -1 if there is none.
+static int
+bfind(uint i, uchar *map, uint from, uint lim, int avoid)
+{
+  int bi, tries;
+
+  for(tries = 0; (bi = bscan(map, from, lim)) >= 0; tries++){
+    if(!avoid || !log_holds(i*BPB + bi))
+      return bi;
+    if(tries >= 32)
+      break;
+    from = bi + 1;
+  }
+  return -1;
+}
 
-// Allocate a zeroed disk block.
+// Mark up to n adjacent free disk blocks in use and return the
+// first, preferring goal or the first free block after it; *got
+// is set to how many.  A goal of 0 means none.  If avoid is set,
+// skip blocks the log holds, so the caller may write them
+// around the log, and return 0 if there seem to be none.
+// Their contents are left as they are.
 static uint
-balloc(uint dev)
+bmarkrun(uint dev, uint goal, uint n, uint *got, int avoid)
 {
-  int b, bi, m;
+  uint i, j, k, start, lim;
+  int bi;
   struct buf *bp;
 
-  bp = 0;
-  for(b = 0; b < sb.size; b += BPB){
-    bp = bread(dev, BBLOCK(b, sb));
-    for(bi = 0; bi < BPB && b + bi < sb.size; bi++){
-      m = 1 << (bi % 8);
-      if((bp->data[bi/8] & m) == 0){  // Is block free?
-        bp->data[bi/8] |= m;  // Mark block in use.
-        log_write(bp);
-        brelse(bp);
-        bzero(dev, b + bi);
-        return b + bi;
-      }
+  if(goal == 0 || goal >= sb.size)
+    goal = bsum.cursor;
+  start = goal / BPB;
+  for(k = 0; k < bsum.nbmap; k++){
+    i = (start + k) % bsum.nbmap;
+    if(bsum.nfree[i] == 0)
+      continue;
+    bp = bread(dev, sb.bmapstart + i);
+    fsstats.bmapscans++;
+    if(bsum.nfree[i] == 0){  // taken while we waited for the buffer
+      brelse(bp);
+      continue;
+    }
+    lim = bmapbits(i);
+    bi = -1;
+    if(k == 0 && goal % BPB > bsum.hint[i])
+      bi = bfind(i, bp->data, goal % BPB, lim, avoid);
+    if(bi < 0)
+      bi = bfind(i, bp->data, bsum.hint[i], lim, avoid);
+    if(bi < 0){
+      if(!avoid)
+        panic("bmark: summary");
+      brelse(bp);
+      continue;
     }
+    for(*got = 0; *got < n && bi + *got < lim; (*got)++){
+      j = bi + *got;
+      if((bp->data[j/8] & (1 << (j % 8))) ||
+         (*got > 0 && avoid && log_holds(i*BPB + j)))
+        break;
+      bp->data[j/8] |= 1 << (j % 8);  // Mark block in use.
+    }
+    log_write_range(bp, bi/8, (bi + *got - 1)/8 - bi/8 + 1);
+    bsum.nfree[i] -= *got;
+    if(bi == bsum.hint[i])
+      bsum.hint[i] = bi + *got;
     brelse(bp);
+    fsstats.ballocs += *got;
+    bsum.cursor = i*BPB + bi + *got;
+    return i*BPB + bi;
   }
-  panic("balloc: out of blocks");
+  if(!avoid)
+    panic("balloc: out of blocks");
+  *got = 0;
+  return 0;
+}
+
+// Mark a free disk block in use and return it, preferring goal
+// or the first free block after it.  A goal of 0 means none.
+// Its contents are left as they are.
+static uint
+bmark(uint dev, uint goal)
+{
+  uint got;
+
+  return bmarkrun(dev, goal, 1, &got, 0);
+}
+
+// Allocate a zeroed disk block near goal.
+static uint
+balloc(uint dev, uint goal)
+{
+  uint b;
+
+  b = bmark(dev, goal);
+  bzero(dev, b);
+  return b;
 }
 
 // Free a disk block.
@@ -94,8 +326,15 @@ bfree(int dev, uint b)
   if((bp->data[bi/8] & m) == 0)
     panic("freeing free block");
   bp->data[bi/8] &= ~m;
-  log_write(bp);
+  log_write_range(bp, bi/8, 1);
+  bsum.nfree[b/BPB]++;
+  if(bi < bsum.hint[b/BPB])
+    bsum.hint[b/BPB] = bi;
   brelse(bp);
+  acquire(&bsum.lock);
+  bsum.free++;
+  release(&bsum.lock);
+  log_freed(b);
 }
 
 // Inodes.
@@ -123,22 +362,31 @@ bfree(int dev, uint b)
 //   is non-zero. ialloc() allocates, and iput() frees if
 //   the reference and link counts have fallen to zero.
 //
-// * Referencing in cache: an entry in the inode cache
-//   is free if ip->ref is zero. Otherwise ip->ref tracks
-//   the number of in-memory pointers to the entry (open
-//   files and current directories). iget() finds or
-//   creates a cache entry and increments its ref; iput()
-//   decrements ref.
+// * Referencing in cache: ip->ref tracks the number of
+//   in-memory pointers to a cache entry (open files and
+//   current directories). iget() finds or creates a cache
+//   entry and increments its ref; iput() decrements ref.
+//   An entry whose ref is zero keeps its inode, so the next
+//   iget() need not read it again, until iget() recycles
+//   the least recently used such entry for another inode.
 //
 // * Valid: the information (type, size, &c) in an inode
 //   cache entry is only correct when ip->valid is 1.
-//   ilock() reads the inode from
-//   the disk and sets ip->valid, while iput() clears
-//   ip->valid if ip->ref has fallen to zero.
+//   ilock() reads the inode from the disk and sets
+//   ip->valid, while iput() clears ip->valid when it
+//   frees the inode.
 //
 // * Locked: file system code may only examine and modify
 //   the information in an inode and its content if it
-//   has first locked the inode.
+//   has first locked the inode.  ilockshared() lets
+//   code that only examines it share the lock.
+//
+// * Dirty: iupdate() only notes that a cached inode differs
+//   from its disk copy, and remembers it in the process,
+//   holding a reference so that it stays in the cache.
+//   iupdatedone(), called by end_op(), copies each such inode
+//   to its block once per operation however often it changed;
+//   iput() does so before an inode leaves the cache.
 //
 // Thus a typical sequence is:
 //   ip = iget(dev, inum)
@@ -159,119 +407,318 @@ bfree(int dev, uint b)
 // multi-step atomic operations.
 //
 // The icache.lock spin-lock protects the allocation of icache
-// entries. Since ip->ref indicates whether an entry is free,
+// entries. Since ip->ref indicates whether an entry is in use,
 // and ip->dev and ip->inum indicate which i-node an entry
-// holds, one must hold icache.lock while using any of those fields.
+// holds, one must hold icache.lock while using any of those
+// fields, or the hash chains and LRU list.
 //
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
-// dev, and inum.  One must hold ip->lock in order to
+// dev, inum and the list links.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
+//
+// The cache starts with NINODE entries and takes a page of
+// new ones from kalloc() whenever every entry holds an inode,
+// up to NINODEMAX; only then does iget() recycle entries.
+// Pages are never given back.  Entries holding an inode are
+// found through a hash table on (dev, inum).
+
+#define NIHASH  128
 
 struct {
   struct spinlock lock;
   struct inode inode[NINODE];
+  struct inode *hash[NIHASH];  // chains through hnext
+  struct inode *all[NINODEMAX];
+  int n;                       // entries in all[]
+
+  // Unreferenced entries, through prev/next.
+  // head.next is most recently used; those holding
+  // no inode (inum 0) are at the end.
+  struct inode head;
 } icache;
 
+static struct inode**
+ihash(uint dev, uint inum)
+{
+  return &icache.hash[(inum ^ dev * 31) % NIHASH];
+}
+
+static void
+iunhash(struct inode *ip)
+{
+  struct inode **pp;
+
+  for(pp = ihash(ip->dev, ip->inum); *pp != ip; pp = &(*pp)->hnext)
+    if(*pp == 0)
+      panic("iunhash");
+  *pp = ip->hnext;
+}
+
+// Put ip on the LRU list, at the front or the back.
+static void
+ilruadd(struct inode *ip, int front)
+{
+  struct inode *at;
+
+  at = front ? &icache.head : icache.head.prev;
+  ip->next = at->next;
+  ip->prev = at;
+  at->next->prev = ip;
+  at->next = ip;
+}
+
+static void
+ilruremove(struct inode *ip)
+{
+  ip->next->prev = ip->prev;
+  ip->prev->next = ip->next;
+}
+
+// Add a new entry, holding no inode, to the cache.
+static void
+inew(struct inode *ip)
+{
+  initsleeplock(&ip->lock, "inode");
+  icache.all[icache.n++] = ip;
+  ilruadd(ip, 0);
+}
+
+// Grow the cache by a page of entries.  Caller holds icache.lock.
+// Returns 0 if it cannot.
+static int
+igrow(void)
+{
+  struct inode *ip;
+  char *pg;
+  int i;
+
+  if(icache.n >= NINODEMAX || (pg = kalloc()) == 0)
+    return 0;
+  memset(pg, 0, PGSIZE);
+  ip = (struct inode*)pg;
+  for(i = 0; i < PGSIZE/sizeof(*ip) && icache.n < NINODEMAX; i++)
+    inew(ip + i);
+  return 1;
+}
+
 void
 iinit(int dev)
 {
   int i = 0;
   
   initlock(&icache.lock, "icache");
+  icache.head.prev = &icache.head;
+  icache.head.next = &icache.head;
   for(i = 0; i < NINODE; i++) {
-    initsleeplock(&icache.inode[i].lock, "inode");
+    inew(&icache.inode[i]);
   }
+  dcinit();
 
   readsb(dev, &sb);
   cprintf("sb: size %d nblocks %d ninodes %d nlog %d logstart %d\
- inodestart %d bmap start %d\n", sb.size, sb.nblocks,
+ inodestart %d bmap start %d bsize %d\n", sb.size, sb.nblocks,
           sb.ninodes, sb.nlog, sb.logstart, sb.inodestart,
-          sb.bmapstart);
+          sb.bmapstart, sb.bsize);
+  if(sb.bsize != BSIZE && !(sb.bsize == 0 && BSIZE == 512))
+    panic("iinit: image block size differs from BSIZE");
 }
 
 static struct inode* iget(uint dev, uint inum);
 
+// Like the block allocator, ialloc() keeps a count of free
+// inodes per inode block, built at mount, so it reads only
+// blocks that have a free inode.  A count changes only while
+// its inode block's buffer is locked: ialloc() takes an inode,
+// iupdate() notices one being freed.
+
+static struct {
+  uint nblocks;          // inode blocks
+  uint cursor;           // where searches without a hint start
+  ushort nfree[NIBLOCK]; // free inodes per inode block
+} isum;
+
+// Is dinode number inum in its block one ialloc() may hand out?
+static int
+iusable(uint inum)
+{
+  return inum != 0 && inum < sb.ninodes;
+}
+
+// Build the free-inode summary from the inode blocks on disk.
+// Called once, after log recovery.
+void
+isuminit(int dev)
+{
+  struct buf *bp;
+  struct dinode *dip;
+  uint i, j;
+
+  isum.nblocks = (sb.ninodes + IPB - 1) / IPB;
+  if(isum.nblocks > NIBLOCK)
+    panic("isuminit: too many inodes");
+  for(i = 0; i < isum.nblocks; i++){
+    bp = bread(dev, sb.inodestart + i);
+    dip = (struct dinode*)bp->data;
+    isum.nfree[i] = 0;
+    for(j = 0; j < IPB; j++)
+      if(iusable(i*IPB + j) && dip[j].type == 0)
+        isum.nfree[i]++;
+    brelse(bp);
+  }
+  isum.cursor = 0;
+}
+
 //PAGEBREAK!
 // Allocate an inode on device dev.
 // Mark it as allocated by  giving it type type.
+// Prefers the inode block holding inode near, if any,
+// so that a directory and its entries share blocks.
 // Returns an unlocked but allocated and referenced inode.
 struct inode*
-ialloc(uint dev, short type)
+ialloc(uint dev, short type, uint near)
 {
-  int inum;
+  uint inum, i, n, start;
   struct buf *bp;
   struct dinode *dip;
 
-  for(inum = 1; inum < sb.ninodes; inum++){
-    bp = bread(dev, IBLOCK(inum, sb));
-    dip = (struct dinode*)bp->data + inum%IPB;
-    if(dip->type == 0){  // a free inode
-      memset(dip, 0, sizeof(*dip));
-      dip->type = type;
-      log_write(bp);   // mark it allocated on the disk
-      brelse(bp);
-      return iget(dev, inum);
+  start = iusable(near) ? near / IPB : isum.cursor;
+  for(n = 0; n < isum.nblocks; n++){
+    i = (start + n) % isum.nblocks;
+    if(isum.nfree[i] == 0)
+      continue;
+    bp = bread(dev, sb.inodestart + i);
+    fsstats.iscans++;
+    for(inum = i*IPB; inum < (i+1)*IPB; inum++){
+      dip = (struct dinode*)bp->data + inum%IPB;
+      if(iusable(inum) && dip->type == 0){  // a free inode
+        memset(dip, 0, sizeof(*dip));
+        dip->type = type;
+        // mark it allocated on the disk
+        log_write_range(bp, (uchar*)dip - bp->data, sizeof(*dip));
+        isum.nfree[i]--;
+        brelse(bp);
+        isum.cursor = i;
+        fsstats.iallocs++;
+        return iget(dev, inum);
+      }
     }
+    if(isum.nfree[i] != 0)
+      panic("ialloc: summary");
     brelse(bp);
   }
   panic("ialloc: no inodes");
 }
 
-// Copy a modified in-memory inode to disk.
-// Must be called after every change to an ip->xxx field
-// that lives on disk, since i-node cache is write-through.
-// Caller must hold ip->lock.
-void
-iupdate(struct inode *ip)
+// Copy a modified in-memory inode to disk, if it is dirty.
+// Caller must hold ip->lock and be in a transaction.
+static void
+iflush(struct inode *ip)
 {
   struct buf *bp;
   struct dinode *dip;
 
+  if(!ip->dirty)
+    return;
+  ip->dirty = 0;
+  fsstats.iwrites++;
   bp = bread(ip->dev, IBLOCK(ip->inum, sb));
   dip = (struct dinode*)bp->data + ip->inum%IPB;
+  if(dip->type != 0 && ip->type == 0)
+    isum.nfree[ip->inum / IPB]++;
   dip->type = ip->type;
   dip->major = ip->major;
   dip->minor = ip->minor;
   dip->nlink = ip->nlink;
-  dip->size = ip->size;
+  // The disk gets no size that covers delayed blocks, which
+  // have no disk block yet.
+  dip->size = ip->ndelay ? ip->dfirst*BSIZE : ip->size;
   dip->perm = ip->perm;
   dip->owner = ip->owner;
   memmove(dip->addrs, ip->addrs, sizeof(ip->addrs));
-  log_write(bp);
+  log_write_range(bp, (uchar*)dip - bp->data, sizeof(*dip));
   brelse(bp);
 }
 
+// Note a change to an ip->xxx field that lives on disk.
+// Must be called after every such change; the inode is
+// written back when the operation ends, and kept in the
+// cache until then.
+// Caller must hold ip->lock and be in a transaction.
+void
+iupdate(struct inode *ip)
+{
+  struct proc *p = myproc();
+
+  if(ip->dirty)
+    return;   // someone's end_op() will write it
+  ip->dirty = 1;
+  if(p->ndirtyi == NDIRTYI){
+    iflush(ip);
+    return;
+  }
+  p->dirtyi[p->ndirtyi++] = idup(ip);
+}
+
+// Write back the inodes this process dirtied, and drop the
+// references iupdate() took. Called by end_op() while the
+// operation is still part of the running transaction, holding
+// no inode locks. An inode may have been written by someone
+// else's end_op() already; then iflush() does nothing.
+void
+iupdatedone(void)
+{
+  struct proc *p = myproc();
+  struct inode *ip;
+
+  while(p->ndirtyi > 0){
+    ip = p->dirtyi[--p->ndirtyi];
+    acquiresleep(&ip->lock);
+    iflush(ip);
+    releasesleep(&ip->lock);
+    iput(ip);
+  }
+}
+
 // Find the inode with number inum on device dev
 // and return the in-memory copy. Does not lock
 // the inode and does not read it from disk.
 static struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip;
 
   acquire(&icache.lock);
 
   // Is the inode already cached?
-  empty = 0;
-  for(ip = &icache.inode[0]; ip < &icache.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
-      ip->ref++;
+  for(ip = *ihash(dev, inum); ip; ip = ip->hnext){
+    if(ip->dev == dev && ip->inum == inum){
+      if(ip->ref++ == 0)
+        ilruremove(ip);
       release(&icache.lock);
       return ip;
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
   }
 
-  // Recycle an inode cache entry.
-  if(empty == 0)
+  // Use an empty entry, growing the cache if there is none,
+  // or else recycle the least recently used one.
+  ip = icache.head.prev;
+  if((ip == &icache.head || ip->inum != 0) && igrow())
+    ip = icache.head.prev;
+  if(ip == &icache.head)
     panic("iget: no inodes");
+  ilruremove(ip);
+  if(ip->inum != 0)
+    iunhash(ip);
 
-  ip = empty;
+  // Tell namefast() this entry is about to hold another inode.
+  ip->seq += 2;
+  __sync_synchronize();
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
+  ip->hnext = *ihash(dev, inum);
+  *ihash(dev, inum) = ip;
   release(&icache.lock);
 
   return ip;
@@ -288,6 +735,15 @@ idup(struct inode *ip)
   return ip;
 }
 
+// Make ip->seq odd before changing ip, and even after.
+static void
+iseqbump(struct inode *ip)
+{
+  __sync_synchronize();
+  ip->seq++;
+  __sync_synchronize();
+}
+
 // Lock the given inode.
 // Reads the inode from disk if necessary.
 void
@@ -300,8 +756,10 @@ ilock(struct inode *ip)
     panic("ilock");
 
   acquiresleep(&ip->lock);
+  iseqbump(ip);
 
   if(ip->valid == 0){
+    fsstats.ireads++;
     bp = bread(ip->dev, IBLOCK(ip->inum, sb));
     dip = (struct dinode*)bp->data + ip->inum%IPB;
     ip->type = dip->type;
@@ -313,19 +771,41 @@ ilock(struct inode *ip)
     ip->owner = dip->owner;
     memmove(ip->addrs, dip->addrs, sizeof(ip->addrs));
     brelse(bp);
+    ip->goal = 0;
+    ip->ext.len = 0;
     ip->valid = 1;
     if(ip->type == 0)
       panic("ilock: no type");
   }
 }
 
-// Unlock the given inode.
+// Lock the given inode shared, for reading only: readi(),
+// stati() and dirlookup() are safe with it shared.
+// If the inode must be read from disk, the lock is taken
+// exclusively instead, which is good for reading too.
+void
+ilockshared(struct inode *ip)
+{
+  if(ip == 0 || ip->ref < 1)
+    panic("ilockshared");
+
+  acquiresleepshared(&ip->lock);
+  // Only an exclusive holder sets valid, so it cannot change now.
+  if(ip->valid == 0){
+    releasesleep(&ip->lock);
+    ilock(ip);
+  }
+}
+
+// Unlock the given inode, locked either way.
 void
 iunlock(struct inode *ip)
 {
-  if(ip == 0 || !holdingsleep(&ip->lock) || ip->ref < 1)
+  if(ip == 0 || !holdingsleepany(&ip->lock) || ip->ref < 1)
     panic("iunlock");
 
+  if(holdingsleep(&ip->lock))
+    iseqbump(ip);
   releasesleep(&ip->lock);
 }
 
@@ -340,22 +820,45 @@ void
 iput(struct inode *ip)
 {
   acquiresleep(&ip->lock);
-  if(ip->valid && ip->nlink == 0){
+  iseqbump(ip);
+  if(ip->valid && (ip->nlink == 0 || ip->ndelay > 0 || ip->dirty)){
     acquire(&icache.lock);
     int r = ip->ref;
     release(&icache.lock);
-    if(r == 1){
+    if(r == 1 && ip->nlink == 0){
       // inode has no links and no other references: truncate and free.
+      if(ip->type == T_DIR)
+        dcforget(ip);
       itrunc(ip);
       ip->type = 0;
       iupdate(ip);
+      iflush(ip);
       ip->valid = 0;
+    } else if(r == 1){
+      // Closing a writable file flushed its delayed blocks,
+      // which cannot fail: their disk blocks were promised.
+      if(ip->ndelay > 0)
+        panic("iput: delayed blocks");
+      // Write it back before it can leave the cache.
+      iflush(ip);
     }
   }
+  iseqbump(ip);
   releasesleep(&ip->lock);
 
   acquire(&icache.lock);
-  ip->ref--;
+  if(--ip->ref == 0){
+    // No one else can be looking at ip->valid.
+    if(ip->valid)
+      ilruadd(ip, 1);
+    else {
+      iunhash(ip);
+      ip->seq += 2;
+      __sync_synchronize();
+      ip->inum = 0;
+      ilruadd(ip, 0);
+    }
+  }
   release(&icache.lock);
 }
 
@@ -373,116 +876,735 @@ iunlockput(struct inode *ip)
 // The content (data) associated with each inode is stored
 // in blocks on the disk. The first NDIRECT block numbers
 // are listed in ip->addrs[].  The next NINDIRECT blocks are
-// listed in block ip->addrs[NDIRECT].
+// listed in block ip->addrs[NDIRECT].  The NDINDIRECT after
+// that are listed in the blocks that block ip->addrs[NDIRECT+1]
+// lists, NINDIRECT in each.
 
-// Return the disk block address of the nth block in inode ip.
-// If there is no such block, bmap allocates one.
+// Allocate a block for inode ip, zeroed unless fresh is set,
+// as close as possible after the last one it was given, so a
+// file written in order ends up contiguous on disk.
 static uint
-bmap(struct inode *ip, uint bn)
+ballocfor(struct inode *ip, int *fresh)
 {
-  uint addr, *a;
+  uint addr;
+
+  if(bclaim(ip, 1) == 0)
+    panic("balloc: out of blocks");
+  if(fresh){
+    addr = bmark(ip->dev, ip->goal);
+    *fresh = 1;
+  } else
+    addr = balloc(ip->dev, ip->goal);
+  if(ip->goal && addr != ip->goal)
+    fsstats.goalmisses++;
+  ip->goal = addr + 1;
+  return addr;
+}
+
+// Extents.
+//
+// A regular file with IF_EXTENTS in ip->minor maps its blocks
+// with extents instead of block numbers: up to NIEXT of them in
+// addrs[] itself or, once those are used up (IF_EXTBLK), in up
+// to NIEXT extent blocks that addrs[] lists, each entry's start
+// naming an extent block and its len counting the extents in it.
+// Extents are kept in the order they were made.  ip->ext caches
+// the last one looked up or extended, so walking or appending
+// to a run needs no search.  Files made by mkfs, directories
+// and devices keep the block-number format.
+
+#define IEXT(ip) ((ip)->type != T_DEV && ((ip)->minor & IF_EXTENTS))
+#define IINLINE(ip) ((ip)->type != T_DEV && ((ip)->minor & IF_INLINE))
+
+static struct extent*
+iexts(struct inode *ip)
+{
+  return (struct extent*)ip->addrs;
+}
+
+// Return the disk block for the nth block in extent inode ip,
+// or 0 if it has none.  Sets *x to the extent that has it and
+// *at to where that is kept: an index into addrs[], or with
+// IF_EXTBLK, i*EPB + j for extent j of block i.  If *x already
+// has the block, *at is left alone.
+static uint
+efind(struct inode *ip, uint bn, struct extent *x, uint *at)
+{
+  struct extent *e;
   struct buf *bp;
+  uint i, j;
 
-  if(bn < NDIRECT){
-    if((addr = ip->addrs[bn]) == 0)
-      ip->addrs[bn] = addr = balloc(ip->dev);
-    return addr;
-  }
-  bn -= NDIRECT;
+  if(x->len > 0 && bn - x->lbn < x->len)
+    return x->start + bn - x->lbn;
 
-  if(bn < NINDIRECT){
-    // Load indirect block, allocating if necessary.
-    if((addr = ip->addrs[NDIRECT]) == 0)
-      ip->addrs[NDIRECT] = addr = balloc(ip->dev);
-    bp = bread(ip->dev, addr);
-    a = (uint*)bp->data;
-    if((addr = a[bn]) == 0){
-      a[bn] = addr = balloc(ip->dev);
-      log_write(bp);
+  e = iexts(ip);
+  for(i = 0; i < NIEXT; i++){
+    if(e[i].len == 0)
+      continue;
+    if(!(ip->minor & IF_EXTBLK)){
+      if(bn - e[i].lbn < e[i].len){
+        *x = e[i];
+        *at = i;
+        return x->start + bn - x->lbn;
+      }
+      continue;
+    }
+    bp = bread(ip->dev, e[i].start);
+    for(j = 0; j < e[i].len; j++){
+      if(bn - ((struct extent*)bp->data)[j].lbn <
+         ((struct extent*)bp->data)[j].len){
+        *x = ((struct extent*)bp->data)[j];
+        *at = i*EPB + j;
+        brelse(bp);
+        return x->start + bn - x->lbn;
+      }
     }
     brelse(bp);
-    return addr;
   }
+  return 0;
+}
 
-  panic("bmap: out of range");
+// Like efind(), caching the extent in ip->ext and ip->extat
+// for the next call and for eappend().
+static uint
+emap(struct inode *ip, uint bn)
+{
+  return efind(ip, bn, &ip->ext, &ip->extat);
 }
 
-// Truncate inode (discard contents).
-// Only called when the inode has no links
-// to it (no directory entries referring to it)
-// and has no in-memory reference to it (is
-// not an open file or current directory).
+// Store ip->ext where ip->extat says.
 static void
-itrunc(struct inode *ip)
+estore(struct inode *ip)
 {
-  int i, j;
   struct buf *bp;
-  uint *a;
+  uint i, j;
 
-  for(i = 0; i < NDIRECT; i++){
-    if(ip->addrs[i]){
-      bfree(ip->dev, ip->addrs[i]);
-      ip->addrs[i] = 0;
-    }
+  if(!(ip->minor & IF_EXTBLK)){
+    iexts(ip)[ip->extat] = ip->ext;
+    iupdate(ip);
+    return;
   }
+  i = ip->extat / EPB;
+  j = ip->extat % EPB;
+  bp = bread(ip->dev, iexts(ip)[i].start);
+  ((struct extent*)bp->data)[j] = ip->ext;
+  log_write_range(bp, j*sizeof(struct extent), sizeof(struct extent));
+  brelse(bp);
+}
 
-  if(ip->addrs[NDIRECT]){
-    bp = bread(ip->dev, ip->addrs[NDIRECT]);
-    a = (uint*)bp->data;
-    for(j = 0; j < NINDIRECT; j++){
-      if(a[j])
-        bfree(ip->dev, a[j]);
-    }
-    brelse(bp);
-    bfree(ip->dev, ip->addrs[NDIRECT]);
-    ip->addrs[NDIRECT] = 0;
+// How many more extents ip has room for.
+static uint
+eroom(struct inode *ip)
+{
+  uint i, n;
+
+  n = 0;
+  for(i = 0; i < NIEXT; i++){
+    if(ip->minor & IF_EXTBLK)
+      n += iexts(ip)[i].len;
+    else if(iexts(ip)[i].len > 0)
+      n++;
   }
-
-  ip->size = 0;
-  iupdate(ip);
+  return NIEXT*EPB - n;
 }
 
-// Copy stat information from inode.
-// Caller must hold ip->lock.
-void
-stati(struct inode *ip, struct stat *st)
+// Find room for a new extent in ip, moving the extents in
+// addrs[] to an extent block or starting a new extent block
+// if need be.  Returns where, as emap() sets ip->extat, or -1.
+static int
+enew(struct inode *ip)
 {
-  st->dev = ip->dev;
-  st->ino = ip->inum;
-  st->type = ip->type;
-  st->nlink = ip->nlink;
-  st->size = ip->size;
-  st->perm = ip->perm;
-  st->owner = ip->owner;
+  struct extent *e;
+  struct buf *bp;
+  uint i, b;
+
+  e = iexts(ip);
+  if(!(ip->minor & IF_EXTBLK)){
+    for(i = 0; i < NIEXT; i++)
+      if(e[i].len == 0)
+        return i;
+    b = ballocfor(ip, 0);
+    bp = bread(ip->dev, b);
+    memmove(bp->data, e, NIEXT*sizeof(struct extent));
+    log_write_range(bp, 0, NIEXT*sizeof(struct extent));
+    brelse(bp);
+    memset(e, 0, NIEXT*sizeof(struct extent));
+    e[0].start = b;
+    e[0].len = NIEXT;
+    ip->minor |= IF_EXTBLK;
+    ip->ext.len = 0;  // it has moved
+  }
+  for(i = 0; i < NIEXT; i++){
+    if(e[i].start != 0 && e[i].len < EPB){
+      e[i].len++;
+      iupdate(ip);
+      return i*EPB + e[i].len - 1;
+    }
+  }
+  for(i = 0; i < NIEXT; i++){
+    if(e[i].start == 0){
+      e[i].start = ballocfor(ip, 0);
+      e[i].len = 1;
+      iupdate(ip);
+      return i*EPB;
+    }
+  }
+  return -1;
+}
 
-  if (get_username_with_uid(ip->owner, st->owner_name) != 0) {
-    st->owner_name[0] = '\0';
+// Map the nth block of extent inode ip, which has none, to disk
+// block addr.  Returns -1 if ip has no room for another extent.
+static int
+eappend(struct inode *ip, uint bn, uint addr)
+{
+  struct extent *x;
+  int at;
+
+  x = &ip->ext;
+  if(bn > 0 && (x->len == 0 || x->lbn + x->len != bn))
+    emap(ip, bn - 1);
+  if(x->len > 0 && x->lbn + x->len == bn && x->start + x->len == addr){
+    x->len++;
+    estore(ip);
+    return 0;
   }
+  if((at = enew(ip)) < 0)
+    return -1;
+  x->lbn = bn;
+  x->start = addr;
+  x->len = 1;
+  ip->extat = at;
+  estore(ip);
+  return 0;
 }
 
-//PAGEBREAK!
-// Read data from inode.
-// Caller must hold ip->lock.
-int
-readi(struct inode *ip, char *dst, uint off, uint n)
+// Free the blocks of extent inode ip, and its extent blocks.
+static void
+etrunc(struct inode *ip)
 {
-  uint tot, m;
+  struct extent *e, *x;
   struct buf *bp;
+  uint i, j, k;
 
-  if(ip->type == T_DEV){
-    if(ip->major < 0 || ip->major >= NDEV || !devsw[ip->major].read)
-      return -1;
-    return devsw[ip->major].read(ip, dst, n);
+  e = iexts(ip);
+  for(i = 0; i < NIEXT; i++){
+    if(e[i].len == 0)
+      continue;
+    if(!(ip->minor & IF_EXTBLK)){
+      for(k = 0; k < e[i].len; k++)
+        bfree(ip->dev, e[i].start + k);
+      continue;
+    }
+    bp = bread(ip->dev, e[i].start);
+    for(j = 0; j < e[i].len; j++){
+      x = (struct extent*)bp->data + j;
+      for(k = 0; k < x->len; k++)
+        bfree(ip->dev, x->start + k);
+    }
+    brelse(bp);
+    bfree(ip->dev, e[i].start);
   }
+  memset(ip->addrs, 0, sizeof(ip->addrs));
+  ip->minor &= ~IF_EXTBLK;
+  ip->ext.len = 0;
+}
 
-  if(off > ip->size || off + n < off)
-    return -1;
-  if(off + n > ip->size)
+// Return the indirect block listing the nth block in inode
+// ip, which is not a direct block, and set *idx to its index
+// there.  If alloc is set, missing indirect blocks are
+// allocated; otherwise 0 is returned if one is missing.
+static uint
+bindirect(struct inode *ip, uint bn, int alloc, uint *idx)
+{
+  uint addr, *a;
+  struct buf *bp;
+
+  bn -= NDIRECT;
+  if(bn < NINDIRECT){
+    *idx = bn;
+    if(ip->addrs[NDIRECT] == 0 && alloc)
+      ip->addrs[NDIRECT] = ballocfor(ip, 0);
+    return ip->addrs[NDIRECT];
+  }
+  bn -= NINDIRECT;
+
+  if(bn >= NDINDIRECT)
+    panic("bmap: out of range");
+  *idx = bn % NINDIRECT;
+  if(ip->addrs[NDIRECT+1] == 0){
+    if(!alloc)
+      return 0;
+    ip->addrs[NDIRECT+1] = ballocfor(ip, 0);
+  }
+  bp = bread(ip->dev, ip->addrs[NDIRECT+1]);
+  a = (uint*)bp->data;
+  if((addr = a[bn/NINDIRECT]) == 0 && alloc){
+    a[bn/NINDIRECT] = addr = ballocfor(ip, 0);
+    log_write_range(bp, (bn/NINDIRECT)*sizeof(uint), sizeof(uint));
+  }
+  brelse(bp);
+  return addr;
+}
+
+// Return the disk block address of the nth block in inode ip.
+// If there is no such block, bmapalloc allocates one. If fresh
+// is 0 the new block is zeroed; otherwise its contents are left
+// as they are and *fresh is set to 1.  Returns 0 if an extent
+// inode has no room for the block.
+static uint
+bmapalloc(struct inode *ip, uint bn, int *fresh)
+{
+  uint addr, i, *a;
+  struct buf *bp;
+
+  if(IEXT(ip)){
+    if((addr = emap(ip, bn)) != 0)
+      return addr;
+    if(ip->goal == 0 && bn > 0 && (addr = emap(ip, bn-1)) != 0)
+      ip->goal = addr + 1;
+    addr = ballocfor(ip, fresh);
+    if(eappend(ip, bn, addr) < 0){
+      bfree(ip->dev, addr);
+      return 0;
+    }
+    return addr;
+  }
+
+  // Without a goal, aim just past the file's previous block.
+  if(ip->goal == 0 && bn > 0 && bn <= NDIRECT && ip->addrs[bn-1])
+    ip->goal = ip->addrs[bn-1] + 1;
+
+  if(bn < NDIRECT){
+    if((addr = ip->addrs[bn]) == 0)
+      ip->addrs[bn] = addr = ballocfor(ip, fresh);
+    return addr;
+  }
+
+  // Load indirect block, allocating if necessary.
+  bp = bread(ip->dev, bindirect(ip, bn, 1, &i));
+  a = (uint*)bp->data;
+  if((addr = a[i]) == 0){
+    if(ip->goal == 0 && i > 0 && a[i-1])
+      ip->goal = a[i-1] + 1;
+    a[i] = addr = ballocfor(ip, fresh);
+    log_write_range(bp, i*sizeof(uint), sizeof(uint));
+  }
+  brelse(bp);
+  return addr;
+}
+
+// Return the disk block address of the nth block in inode ip.
+// If there is no such block, bmap allocates a zeroed one.
+static uint
+bmap(struct inode *ip, uint bn)
+{
+  return bmapalloc(ip, bn, 0);
+}
+
+// Return the disk block for the nth block in inode ip, or 0
+// if it has none, changing nothing in ip, so that readers
+// sharing ip->lock may call it.  An extent inode's caller
+// passes x to cache the last extent used.
+static uint
+bmapread(struct inode *ip, uint bn, struct extent *x)
+{
+  struct buf *bp;
+  uint addr, i;
+
+  if(IEXT(ip))
+    return efind(ip, bn, x, &i);
+  if(bn < NDIRECT)
+    return ip->addrs[bn];
+  if((addr = bindirect(ip, bn, 0, &i)) == 0)
+    return 0;
+  bp = bread(ip->dev, addr);
+  addr = ((uint*)bp->data)[i];
+  brelse(bp);
+  return addr;
+}
+
+// Does the nth block in inode ip have a disk block?
+static int
+bmapped(struct inode *ip, uint bn)
+{
+  if(IEXT(ip))
+    return emap(ip, bn) != 0;
+  return bmapread(ip, bn, 0) != 0;
+}
+
+// Make addr the disk block for the nth block in inode ip,
+// which has none, allocating indirect blocks if need be.
+static void
+bmapput(struct inode *ip, uint bn, uint addr)
+{
+  struct buf *bp;
+  uint i;
+
+  if(IEXT(ip)){
+    if(eappend(ip, bn, addr) < 0)
+      panic("bmapput: no room for extent");
+    return;
+  }
+  if(bn < NDIRECT){
+    ip->addrs[bn] = addr;
+    return;
+  }
+  bp = bread(ip->dev, bindirect(ip, bn, 1, &i));
+  ((uint*)bp->data)[i] = addr;
+  log_write_range(bp, i*sizeof(uint), sizeof(uint));
+  brelse(bp);
+}
+
+// Delayed allocation.
+//
+// Data that writeidelay() puts in new blocks of a regular file
+// goes into B_DELAY buffers named by inode and block number
+// rather than into freshly allocated disk blocks.  Later,
+// idelayflush() allocates disk blocks for all of an inode's
+// delayed blocks at once, as a run of adjacent blocks where it
+// can, writes the data to them around the log, as writeidirect()
+// does, and logs only the bitmap, indirect block and inode.  It
+// runs when an inode has DELAYBLOCKS delayed blocks, when a
+// writable file is closed, and for fsync() and sync(); itrunc()
+// just drops them.  Each delayed block is promised a free disk
+// block when it is made, so the flush never finds the disk full;
+// a write that finds no block to promise fails instead.
+// Meanwhile ip->size counts the delayed data, but iupdate()
+// gives the disk a size that ends before the first delayed
+// block, so a crash loses the data but leaves no hole.
+
+// Return the locked B_DELAY buffer for block lbn of ip, if any.
+// Otherwise, if delay is set and lbn has no disk block, make
+// one, unless the cache has no room for it.  Returns 0 if the
+// caller should use a disk block.
+static struct buf*
+idelaybuf(struct inode *ip, uint lbn, int delay)
+{
+  struct buf *b;
+
+  if(ip->ndelay > 0 && lbn >= ip->dfirst &&
+     (b = bdget(ip->dev, ip->inum, lbn, 0)) != 0)
+    return b;
+  if(!delay || DELAYBLOCKS == 0)
+    return 0;
+  // Blocks inside the file that are not delayed have disk blocks.
+  if(lbn < (ip->size + BSIZE - 1) / BSIZE || bmapped(ip, lbn))
+    return 0;
+  if(ip->ndelay >= DELAYBLOCKS && idelayflush(ip, 0) < 0)
+    return 0;
+  // Leave room for each delayed block to need its own extent.
+  if(IEXT(ip) && eroom(ip) <= ip->ndelay)
+    return 0;
+  if((b = bdget(ip->dev, ip->inum, lbn, 1)) == 0)
+    return 0;
+  // Promise it a disk block, and the first one the indirect or
+  // extent blocks the flush may need, so the flush cannot fail.
+  if(breserve(ip, ip->ndelay == 0 ? 1 + INDBLOCKS : 1) < 0){
+    bdrop(b);
+    return 0;
+  }
+  if(ip->ndelay == 0 || lbn < ip->dfirst)
+    ip->dfirst = lbn;
+  ip->ndelay++;
+  return b;
+}
+
+// Give ip's delayed blocks disk blocks and write them.  A block
+// the log holds must be logged; at most nlogged are, and if that
+// is not enough idelayflush() stops and returns -1.  That only
+// happens when nearly every free block is still in the log.  The
+// disk blocks were promised when the data was written, so there
+// is no other way to fail.
+// Caller must hold ip->lock and be in a transaction that
+// reserved INDBLOCKS and nlogged blocks.
+int
+idelayflush(struct inode *ip, int nlogged)
+{
+  uint lbn, addr, next, left, i, n;
+  int fresh;
+  struct buf *b, *bp;
+
+  if(!holdingsleep(&ip->lock))
+    panic("idelayflush");
+  if(ip->ndelay == 0)
+    return 0;
+
+  ip->dflush = 1;
+  left = next = 0;
+  for(lbn = ip->dfirst; ip->ndelay > 0; lbn++){
+    if(lbn >= MAXFILE)
+      panic("idelayflush: lost blocks");
+    if((b = bdget(ip->dev, ip->inum, lbn, 0)) == 0)
+      continue;
+    if(left == 0){
+      // One run for all that is left, after the indirect block.
+      if(lbn >= NDIRECT && !IEXT(ip))
+        bindirect(ip, lbn, 1, &i);
+      n = bclaim(ip, ip->ndelay);
+      next = n ? bmarkrun(ip->dev, ip->goal, n, &left, 1) : 0;
+      bunclaim(ip, n - left);
+      if(left > 0 && ip->goal && next != ip->goal)
+        fsstats.goalmisses++;
+    }
+    fresh = 0;
+    if(left > 0){
+      addr = next++;
+      left--;
+      ip->goal = addr + 1;
+    } else if(nlogged > 0){
+      nlogged--;
+      addr = ballocfor(ip, &fresh);
+    } else {
+      brelse(b);
+      ip->dfirst = lbn;
+      ip->dflush = 0;
+      iupdate(ip);
+      return -1;
+    }
+    bmapput(ip, lbn, addr);
+    bp = bzget(ip->dev, addr);
+    memmove(bp->data, b->data, BSIZE);
+    if(fresh)
+      log_write(bp);
+    else
+      bwrite(bp);
+    brelse(bp);
+    bdrop(b);
+    ip->ndelay--;
+    fsstats.delayed++;
+  }
+  ip->dflush = 0;
+  bunreserve(ip);  // what the index blocks did not need
+  iupdate(ip);
+  return 0;
+}
+
+// Forget ip's delayed blocks, for itrunc().
+static void
+idelaydrop(struct inode *ip)
+{
+  uint lbn;
+  struct buf *b;
+
+  for(lbn = ip->dfirst; ip->ndelay > 0; lbn++){
+    if(lbn >= MAXFILE)
+      panic("idelaydrop: lost blocks");
+    if((b = bdget(ip->dev, ip->inum, lbn, 0)) != 0){
+      bdrop(b);
+      ip->ndelay--;
+    }
+  }
+  bunreserve(ip);
+}
+
+// Flush ip's delayed blocks in a transaction of their own.
+void
+idelaysync(struct inode *ip)
+{
+  begin_op(INDBLOCKS + DELAYBLOCKS);
+  ilock(ip);
+  idelayflush(ip, DELAYBLOCKS);
+  iunlock(ip);
+  end_op();
+}
+
+// Flush every inode's delayed blocks, for sync().
+void
+idelaysyncall(void)
+{
+  struct inode *ip;
+  int i;
+
+  for(i = 0; ; i++){
+    acquire(&icache.lock);
+    if(i >= icache.n){
+      release(&icache.lock);
+      break;
+    }
+    ip = icache.all[i];
+    if(ip->ref == 0 || ip->ndelay == 0){
+      release(&icache.lock);
+      continue;
+    }
+    ip->ref++;
+    release(&icache.lock);
+    begin_op(INDBLOCKS + DELAYBLOCKS);
+    ilock(ip);
+    idelayflush(ip, DELAYBLOCKS);
+    iunlockput(ip);
+    end_op();
+  }
+}
+
+// Free indirect block addr and the blocks it lists.
+static void
+bfreeind(int dev, uint addr)
+{
+  struct buf *bp;
+  uint *a;
+  int j;
+
+  bp = bread(dev, addr);
+  a = (uint*)bp->data;
+  for(j = 0; j < NINDIRECT; j++){
+    if(a[j])
+      bfree(dev, a[j]);
+  }
+  brelse(bp);
+  bfree(dev, addr);
+}
+
+// Truncate inode (discard contents).
+// Only called when the inode has no links
+// to it (no directory entries referring to it)
+// and has no in-memory reference to it (is
+// not an open file or current directory).
+static void
+itrunc(struct inode *ip)
+{
+  int i, j;
+  struct buf *bp;
+  uint *a;
+
+  idelaydrop(ip);
+  if(IINLINE(ip)){
+    memset(ip->addrs, 0, sizeof(ip->addrs));
+    ip->size = 0;
+    iupdate(ip);
+    return;
+  }
+  if(IEXT(ip)){
+    etrunc(ip);
+    ip->size = 0;
+    iupdate(ip);
+    return;
+  }
+  for(i = 0; i < NDIRECT; i++){
+    if(ip->addrs[i]){
+      bfree(ip->dev, ip->addrs[i]);
+      ip->addrs[i] = 0;
+    }
+  }
+
+  if(ip->addrs[NDIRECT]){
+    bfreeind(ip->dev, ip->addrs[NDIRECT]);
+    ip->addrs[NDIRECT] = 0;
+  }
+
+  if(ip->addrs[NDIRECT+1]){
+    bp = bread(ip->dev, ip->addrs[NDIRECT+1]);
+    a = (uint*)bp->data;
+    for(j = 0; j < NINDIRECT; j++){
+      if(a[j])
+        bfreeind(ip->dev, a[j]);
+    }
+    brelse(bp);
+    bfree(ip->dev, ip->addrs[NDIRECT+1]);
+    ip->addrs[NDIRECT+1] = 0;
+  }
+
+  ip->size = 0;
+  iupdate(ip);
+}
+
+// Copy stat information from inode.
+// Caller must hold ip->lock.
+void
+stati(struct inode *ip, struct stat *st)
+{
+  st->dev = ip->dev;
+  st->ino = ip->inum;
+  st->type = ip->type;
+  st->nlink = ip->nlink;
+  st->size = ip->size;
+  st->perm = ip->perm;
+  st->owner = ip->owner;
+
+  if (get_username_with_uid(ip->owner, st->owner_name) != 0) {
+    st->owner_name[0] = '\0';
+  }
+}
+
+// Inline data.
+//
+// A new regular file with IF_INLINE keeps its data, up to
+// NINLINE bytes, in addrs[] instead of in a block, so reading
+// it costs only the inode block ilock() reads anyway.  A write
+// past NINLINE moves the data to a block, and from then on the
+// file has blocks (or extents) like any other.
+
+// Move the data of inline inode ip into its first block.
+// Caller must hold ip->lock and be in a transaction.
+static void
+iunline(struct inode *ip)
+{
+  char data[NINLINE];
+  struct buf *bp;
+
+  memmove(data, ip->addrs, NINLINE);
+  memset(ip->addrs, 0, sizeof(ip->addrs));
+  ip->minor &= ~IF_INLINE;
+  iupdate(ip);
+  if(ip->size == 0)
+    return;
+  bp = bread(ip->dev, bmap(ip, 0));
+  memmove(bp->data, data, ip->size);
+  log_write_range(bp, 0, ip->size);
+  brelse(bp);
+}
+
+// Write to inline inode ip and return n if off+n fits in it.
+// Otherwise move its data to a block and return -1.
+static int
+iwriteinline(struct inode *ip, char *src, uint off, uint n)
+{
+  if(off + n > NINLINE){
+    iunline(ip);
+    return -1;
+  }
+  memmove((char*)ip->addrs + off, src, n);
+  if(off + n > ip->size)
+    ip->size = off + n;
+  iupdate(ip);
+  return n;
+}
+
+//PAGEBREAK!
+// Read data from inode.
+// Caller must hold ip->lock.
+int
+readi(struct inode *ip, char *dst, uint off, uint n)
+{
+  uint tot, m, addr;
+  struct buf *bp;
+  struct extent x;
+
+  if(ip->type == T_DEV){
+    if(ip->major < 0 || ip->major >= NDEV || !devsw[ip->major].read)
+      return -1;
+    return devsw[ip->major].read(ip, dst, n);
+  }
+
+  if(off > ip->size || off + n < off)
+    return -1;
+  if(off + n > ip->size)
     n = ip->size - off;
+  if(IINLINE(ip)){
+    memmove(dst, (char*)ip->addrs + off, n);
+    return n;
+  }
 
+  // ip->lock may be shared, so leave ip alone.
+  x = ip->ext;
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
-    bp = bread(ip->dev, bmap(ip, off/BSIZE));
     m = min(n - tot, BSIZE - off%BSIZE);
+    if((bp = idelaybuf(ip, off/BSIZE, 0)) == 0){
+      if((addr = bmapread(ip, off/BSIZE, &x)) == 0){
+        memset(dst, 0, m);
+        continue;
+      }
+      bp = bread(ip->dev, addr);
+    }
     memmove(dst, bp->data + off%BSIZE, m);
     brelse(bp);
   }
@@ -490,12 +1612,15 @@ readi(struct inode *ip, char *dst, uint off, uint n)
 }
 
 // PAGEBREAK!
-// Write data to inode.
+// Write data to inode.  If delay is set, new blocks of a
+// regular file may be left in B_DELAY buffers.  Returns the
+// bytes written, fewer than n if the file ran out of extents
+// or, if delay is set, the disk is full.
 // Caller must hold ip->lock.
-int
-writei(struct inode *ip, char *src, uint off, uint n)
+static int
+iwrite(struct inode *ip, char *src, uint off, uint n, int delay)
 {
-  uint tot, m;
+  uint tot, m, addr;
   struct buf *bp;
 
   if(ip->type == T_DEV){
@@ -506,22 +1631,123 @@ writei(struct inode *ip, char *src, uint off, uint n)
 
   if(off > ip->size || off + n < off)
     return -1;
-  if(off + n > MAXFILE*BSIZE)
+  if(n > 0 && (off + n - 1)/BSIZE >= MAXFILE)
     return -1;
+  if(IINLINE(ip) && iwriteinline(ip, src, off, n) >= 0)
+    return n;
 
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
-    bp = bread(ip->dev, bmap(ip, off/BSIZE));
     m = min(n - tot, BSIZE - off%BSIZE);
+    if((bp = idelaybuf(ip, off/BSIZE, delay)) != 0){
+      memmove(bp->data + off%BSIZE, src, m);
+      brelse(bp);
+      continue;
+    }
+    if(delay && bfull() && !bmapped(ip, off/BSIZE))
+      break;  // the disk is full: fail the write, not the kernel
+    if((addr = bmap(ip, off/BSIZE)) == 0)
+      break;  // out of extents
+    bp = bread(ip->dev, addr);
     memmove(bp->data + off%BSIZE, src, m);
-    log_write(bp);
+    log_write_range(bp, off%BSIZE, m);
     brelse(bp);
   }
 
-  if(n > 0 && off > ip->size){
+  if(tot > 0 && off > ip->size){
     ip->size = off;
     iupdate(ip);
   }
-  return n;
+  return tot;
+}
+
+// Write data to inode, allocating new blocks at once.
+// Caller must hold ip->lock.
+int
+writei(struct inode *ip, char *src, uint off, uint n)
+{
+  return iwrite(ip, src, off, n, 0);
+}
+
+// Write data to inode like writei(), but let new blocks of a
+// regular file wait for idelayflush() to allocate them.  The
+// caller must flush before giving up the file (see fileclose()).
+// Caller must hold ip->lock.
+int
+writeidelay(struct inode *ip, char *src, uint off, uint n)
+{
+  return iwrite(ip, src, off, n, ip->type == T_FILE);
+}
+
+// Write data to inode like writei(), but send the data blocks
+// straight to disk instead of through the log. They reach the
+// disk before the transaction that links new ones into the file
+// commits, so only the metadata is logged. New blocks are not
+// zeroed first. A block the log still holds, or one freed by a
+// transaction that has not committed, must go through the log
+// so a crash or checkpoint cannot undo the write; at most
+// nlogged blocks are logged, and writeidirect() returns a short
+// count once that is used up.
+// Caller must hold ip->lock and be in a transaction.
+int
+writeidirect(struct inode *ip, char *src, uint off, uint n, int nlogged)
+{
+  uint tot, m, addr;
+  int fresh, dirty;
+  struct buf *bp;
+
+  if(ip->type == T_DEV)
+    return writei(ip, src, off, n);
+
+  if(off > ip->size || off + n < off)
+    return -1;
+  if(n > 0 && (off + n - 1)/BSIZE >= MAXFILE)
+    return -1;
+  if(IINLINE(ip) && iwriteinline(ip, src, off, n) >= 0)
+    return n;
+
+  dirty = 0;
+  for(tot=0; tot<n; tot+=m, off+=m, src+=m){
+    m = min(n - tot, BSIZE - off%BSIZE);
+    if((bp = idelaybuf(ip, off/BSIZE, 0)) != 0){
+      memmove(bp->data + off%BSIZE, src, m);
+      brelse(bp);
+      continue;
+    }
+    fresh = 0;
+    if((addr = bmapalloc(ip, off/BSIZE, &fresh)) == 0)
+      break;  // out of extents
+    dirty |= fresh;
+    if(log_holds(addr)){
+      if(nlogged == 0)
+        break;
+      nlogged--;
+      bp = fresh ? bzget(ip->dev, addr) : bread(ip->dev, addr);
+      memmove(bp->data + off%BSIZE, src, m);
+      if(fresh)
+        log_write(bp);
+      else
+        log_write_range(bp, off%BSIZE, m);
+    } else {
+      if(fresh || m == BSIZE)
+        bp = bzget(ip->dev, addr);  // no need to read it
+      else
+        bp = bread(ip->dev, addr);
+      memmove(bp->data + off%BSIZE, src, m);
+      bwrite(bp);
+      fsstats.directwrites++;
+    }
+    brelse(bp);
+  }
+
+  // Log the new size and the block addresses bmapalloc()
+  // put in the inode, even if their data was not written.
+  if(off > ip->size){
+    ip->size = off;
+    dirty = 1;
+  }
+  if(dirty)
+    iupdate(ip);
+  return tot;
 }
 
 //PAGEBREAK!
@@ -533,6 +1759,509 @@ namecmp(const char *s, const char *t)
   return strncmp(s, t, DIRSIZ);
 }
 
+// Hashed directories.
+//
+// A directory that grows past DIRHASH bytes is made into a hash
+// table (IF_DIRHASH), so finding a name reads one block however
+// big the directory gets.  The buckets are chains of blocks, and
+// bucket b's chain starts at block b.  Every block begins with a
+// struct dirhead, which programs reading the directory as plain
+// dirents skip, naming its bucket and the next block in the chain;
+// block 0's also holds the number of buckets.  The table grows by
+// linear hashing: when a name has to go in a new block at the end
+// of a full chain, or the chains average more than 1.25 blocks,
+// dirmaintain() splits the next bucket in turn, in an operation
+// of its own, so create() and link() log at most one more block
+// than with a linear directory.
+
+#define DHEAD(bp)    ((struct dirhead*)(bp)->data)
+#define DENT(bp, i)  ((struct dirent*)(bp)->data + (i))
+#define DHSTAGE      4   // pages dirconvert() can read a directory into
+#define STAGED(pg, i) ((struct dirent*)(pg)[(i) / (PGSIZE/sizeof(struct dirent))] + \
+                       (i) % (PGSIZE/sizeof(struct dirent)))
+
+static uint
+dhash(char *name)
+{
+  uint h;
+  int i;
+
+  h = 2166136261;  // FNV-1a
+  for(i = 0; i < DIRSIZ && name[i]; i++)
+    h = (h ^ (uchar)name[i]) * 16777619;
+  return h;
+}
+
+// Largest power of two <= n.
+static uint
+dhpow2(uint n)
+{
+  uint m;
+
+  for(m = 1; m*2 <= n; m *= 2)
+    ;
+  return m;
+}
+
+// The bucket for hash h in a table of n buckets: buckets below
+// n - m have been split by the next bit of the hash.
+static uint
+dhome(uint h, uint n)
+{
+  uint m;
+
+  m = dhpow2(n);
+  if(h % (2*m) < n)
+    return h % (2*m);
+  return h % m;
+}
+
+// Read block blk of hashed directory dp, which it has.
+// Safe with dp->lock shared.
+static struct buf*
+dhread(struct inode *dp, uint blk)
+{
+  struct extent x;
+  uint addr;
+
+  x.len = 0;
+  if((addr = bmapread(dp, blk, &x)) == 0)
+    panic("dhread: no block");
+  return bread(dp->dev, addr);
+}
+
+static uint
+dhbuckets(struct inode *dp)
+{
+  struct buf *bp;
+  uint n;
+
+  bp = dhread(dp, 0);
+  n = DHEAD(bp)->nbuckets;
+  brelse(bp);
+  return n;
+}
+
+// Add a block to the end of hashed directory dp, in the chain
+// of bucket b, holding de if it is not 0.  Returns its number.
+static uint
+dhappend(struct inode *dp, uint b, struct dirent *de)
+{
+  struct buf *bp;
+  uint blk;
+
+  blk = dp->size / BSIZE;
+  if(blk > 0xffff)
+    panic("dirlink: directory too big");
+  bp = bread(dp->dev, bmap(dp, blk));
+  memset(bp->data, 0, BSIZE);
+  DHEAD(bp)->magic = DH_MAGIC;
+  DHEAD(bp)->bucket = b;
+  if(de)
+    *DENT(bp, 1) = *de;
+  log_write(bp);
+  brelse(bp);
+  dp->size += BSIZE;
+  iupdate(dp);
+  return blk;
+}
+
+// Put de in the chain of bucket b of hashed directory dp.
+// Returns 1 if the chain was full and had to grow.
+static int
+dhinsert(struct inode *dp, uint b, struct dirent *de)
+{
+  struct buf *bp;
+  uint blk, i;
+
+  blk = b;
+  for(;;){
+    bp = dhread(dp, blk);
+    for(i = 1; i < DPB; i++){
+      if(DENT(bp, i)->inum == 0){
+        *DENT(bp, i) = *de;
+        log_write_range(bp, i*sizeof(*de), sizeof(*de));
+        brelse(bp);
+        return 0;
+      }
+    }
+    if((blk = DHEAD(bp)->next) == 0)
+      break;
+    brelse(bp);
+  }
+  DHEAD(bp)->next = dhappend(dp, b, de);
+  log_write_range(bp, 0, sizeof(struct dirhead));
+  brelse(bp);
+  return 1;
+}
+
+// Look for name in hashed directory dp.  Returns its inode
+// number and sets *poff, or returns 0.
+static uint
+dhlookup(struct inode *dp, char *name, uint *poff)
+{
+  struct buf *bp;
+  uint blk, i, inum;
+
+  blk = dhome(dhash(name), dhbuckets(dp));
+  do {
+    bp = dhread(dp, blk);
+    fsstats.dirblocks++;
+    for(i = 1; i < DPB; i++){
+      if(DENT(bp, i)->inum != 0 && namecmp(name, DENT(bp, i)->name) == 0){
+        inum = DENT(bp, i)->inum;
+        if(poff)
+          *poff = blk*BSIZE + i*sizeof(struct dirent);
+        brelse(bp);
+        return inum;
+      }
+    }
+    blk = DHEAD(bp)->next;
+    brelse(bp);
+  } while(blk != 0);
+  return 0;
+}
+
+// Make linear directory dp a hash table.  Returns -1, leaving
+// dp as it was, if that would take too much memory or log.
+static int
+dirconvert(struct inode *dp)
+{
+  char *pg[DHSTAGE];
+  struct dirent *de;
+  struct buf *bp;
+  uint n, nb, npg, i, b;
+
+  npg = (dp->size + PGSIZE - 1) / PGSIZE;
+  if(npg > DHSTAGE)
+    return -1;
+  for(i = 0; i < npg; i++){
+    if((pg[i] = kalloc()) == 0){
+      while(i-- > 0)
+        kfree(pg[i]);
+      return -1;
+    }
+    readi(dp, pg[i], i*PGSIZE, min(PGSIZE, dp->size - i*PGSIZE));
+  }
+
+  // About half as many slots again as entries, and at least as
+  // many buckets as the directory has blocks now.
+  n = 0;
+  for(i = 0; i < dp->size / sizeof(*de); i++)
+    if(STAGED(pg, i)->inum)
+      n++;
+  nb = (2*n + DPB - 2) / (DPB - 1);
+  if(nb < dp->size / BSIZE)
+    nb = dp->size / BSIZE;
+  if(nb + 6 > DIRBLOCKS){
+    for(i = 0; i < npg; i++)
+      kfree(pg[i]);
+    return -1;
+  }
+
+  // There are usually more buckets than blocks: bmap() gives
+  // the directory the blocks it lacks.
+  for(b = 0; b < nb; b++){
+    bp = bread(dp->dev, bmap(dp, b));
+    memset(bp->data, 0, BSIZE);
+    DHEAD(bp)->magic = DH_MAGIC;
+    DHEAD(bp)->bucket = b;
+    if(b == 0)
+      DHEAD(bp)->nbuckets = nb;
+    log_write(bp);
+    brelse(bp);
+  }
+  i = dp->size / sizeof(*de);
+  dp->size = nb * BSIZE;
+  dp->minor |= IF_DIRHASH;
+  iupdate(dp);
+  while(i-- > 0){
+    de = STAGED(pg, i);
+    if(de->inum)
+      dhinsert(dp, dhome(dhash(de->name), nb), de);
+  }
+  for(i = 0; i < npg; i++)
+    kfree(pg[i]);
+  return 0;
+}
+
+// Move block blk of hashed directory dp, which does not start
+// a chain, to the end of the directory.
+static void
+dhmove(struct inode *dp, uint blk)
+{
+  struct buf *bp, *np;
+  uint b, nblk, prev;
+
+  bp = dhread(dp, blk);
+  b = DHEAD(bp)->bucket;
+  nblk = dhappend(dp, b, 0);
+  np = dhread(dp, nblk);
+  memmove(np->data, bp->data, BSIZE);
+  log_write(np);
+  brelse(np);
+  brelse(bp);
+
+  // Point the block before it in the chain at the copy.
+  prev = b;
+  for(;;){
+    bp = dhread(dp, prev);
+    if(DHEAD(bp)->next == blk)
+      break;
+    if((prev = DHEAD(bp)->next) == 0)
+      panic("dhmove");
+    brelse(bp);
+  }
+  DHEAD(bp)->next = nblk;
+  log_write_range(bp, 0, sizeof(struct dirhead));
+  brelse(bp);
+}
+
+// Split the next bucket of hashed directory dp.  With n buckets
+// and m the largest power of two <= n, bucket n - m becomes
+// buckets n - m and n, and block n starts the new chain.
+static void
+dirsplit(struct inode *dp)
+{
+  struct buf *bp;
+  struct dirent de;
+  uint n, s, k, blk, i;
+
+  n = dhbuckets(dp);
+  s = n - dhpow2(n);
+  if(n >= 0xffff)
+    return;
+
+  // Each block of the chain, as many for the new chain, the
+  // moved block and what points at it, block 0, and allocation.
+  k = 0;
+  blk = s;
+  do {
+    bp = dhread(dp, blk);
+    blk = DHEAD(bp)->next;
+    brelse(bp);
+    k++;
+  } while(blk != 0);
+  if(2*k + 8 > DIRBLOCKS)
+    return;
+
+  if(n < dp->size / BSIZE){
+    dhmove(dp, n);
+    bp = dhread(dp, n);
+    memset(bp->data, 0, BSIZE);
+    DHEAD(bp)->magic = DH_MAGIC;
+    DHEAD(bp)->bucket = n;
+    log_write(bp);
+    brelse(bp);
+  } else
+    dhappend(dp, n, 0);
+
+  blk = s;
+  do {
+    bp = dhread(dp, blk);
+    for(i = 1; i < DPB; i++){
+      if(DENT(bp, i)->inum == 0 ||
+         dhome(dhash(DENT(bp, i)->name), n+1) != n)
+        continue;
+      de = *DENT(bp, i);
+      memset(DENT(bp, i), 0, sizeof(de));
+      log_write_range(bp, i*sizeof(de), sizeof(de));
+      dhinsert(dp, n, &de);
+    }
+    blk = DHEAD(bp)->next;
+    brelse(bp);
+  } while(blk != 0);
+
+  bp = dhread(dp, 0);
+  DHEAD(bp)->nbuckets = n + 1;
+  log_write_range(bp, 0, sizeof(struct dirhead));
+  brelse(bp);
+  fsstats.dirsplits++;
+}
+
+// Have the running operation's end_op() hash or split dp.
+static void
+dirwork(struct inode *dp)
+{
+  struct proc *p = myproc();
+
+  if(p->dirwork == 0)
+    p->dirwork = idup(dp);
+}
+
+// Hash or split the directory whose growth the operation that
+// just ended noted, in an operation of its own.
+// Called by end_op().
+void
+dirmaintain(void)
+{
+  struct proc *p = myproc();
+  struct inode *dp;
+
+  if((dp = p->dirwork) == 0)
+    return;
+  p->dirwork = 0;
+  begin_op(DIRBLOCKS);
+  ilock(dp);
+  if(dp->nlink > 0){
+    if(dp->minor & IF_DIRHASH)
+      dirsplit(dp);
+    else
+      dirconvert(dp);
+  }
+  iunlockput(dp);
+  end_op();
+}
+
+// Name cache.
+//
+// namex() looks up the same few names over and over, and each
+// dirlookup() reads the directory.  The dcache remembers, for a
+// (directory, name) pair, the inode number it maps to, or 0 if
+// the name is known to be absent.  An entry for directory dp is
+// only read or changed with dp locked, by dirlookup(), dirlink()
+// and unlink, so it is never stale while dp is locked.  Lookups
+// may share dp->lock and so add the same name at once; the spin
+// lock protects the table, and dcupdate() checks for the name
+// under it.  Each name hashes to a set of DCWAYS entries,
+// replaced least recently used first.  A set's seq is odd while
+// its entries change, for namefast(), which reads them unlocked.
+
+#define DCWAYS  4
+#define NDCSET  (NDCACHE/DCWAYS)
+
+struct dentry {
+  uint dev;
+  uint dinum;          // directory's inode number; 0 if free
+  char name[DIRSIZ];
+  uint inum;           // 0 for a name known to be absent
+  uint used;           // dcache.clock at last use
+};
+
+static struct {
+  struct spinlock lock;
+  uint clock;
+  struct dentry ent[NDCACHE];
+  uint seq[NDCSET];
+} dcache;
+
+static void
+dcinit(void)
+{
+  initlock(&dcache.lock, "dcache");
+}
+
+static uint
+dcset(uint dinum, char *name)
+{
+  return (dhash(name) ^ dinum * 2654435761U) % NDCSET;
+}
+
+static struct dentry*
+dcfind(uint dev, uint dinum, char *name)
+{
+  struct dentry *e, *set;
+
+  set = &dcache.ent[dcset(dinum, name) * DCWAYS];
+  for(e = set; e < set + DCWAYS; e++)
+    if(e->dinum == dinum && e->dev == dev &&
+       namecmp(e->name, name) == 0)
+      return e;
+  return 0;
+}
+
+// Look name up in dp's cached entries.  Returns 1 and sets
+// *inum (0 if absent) on a hit, 0 on a miss.  Caller holds dp->lock.
+static int
+dclookup(struct inode *dp, char *name, uint *inum)
+{
+  struct dentry *e;
+
+  acquire(&dcache.lock);
+  if((e = dcfind(dp->dev, dp->inum, name)) == 0){
+    fsstats.dcmisses++;
+    release(&dcache.lock);
+    return 0;
+  }
+  fsstats.dchits++;
+  e->used = ++dcache.clock;
+  *inum = e->inum;
+  release(&dcache.lock);
+  return 1;
+}
+
+// Like dclookup(), without the lock, for namefast().  The caller
+// checks that directory dinum did not change meanwhile; a miss
+// or a set that changed makes it return 0.
+static int
+dcfast(uint dev, uint dinum, char *name, uint *inum)
+{
+  struct dentry *e;
+  uint set, s;
+
+  set = dcset(dinum, name);
+  s = dcache.seq[set];
+  __sync_synchronize();
+  if(s & 1)
+    return 0;
+  if((e = dcfind(dev, dinum, name)) == 0)
+    return 0;
+  *inum = e->inum;
+  __sync_synchronize();
+  return dcache.seq[set] == s;
+}
+
+// Record that name in dp maps to inum, or to nothing if inum is 0.
+// Caller holds dp->lock.
+void
+dcupdate(struct inode *dp, char *name, uint inum)
+{
+  struct dentry *e, *set;
+  uint n;
+  int i;
+
+  acquire(&dcache.lock);
+  n = dcset(dp->inum, name);
+  dcache.seq[n]++;
+  __sync_synchronize();
+  if((e = dcfind(dp->dev, dp->inum, name)) == 0){
+    set = e = &dcache.ent[n * DCWAYS];
+    for(i = 1; i < DCWAYS; i++)
+      if(set[i].dinum == 0 || (e->dinum != 0 && set[i].used < e->used))
+        e = &set[i];
+    e->dev = dp->dev;
+    e->dinum = dp->inum;
+    strncpy(e->name, name, DIRSIZ);
+  }
+  e->inum = inum;
+  e->used = ++dcache.clock;
+  __sync_synchronize();
+  dcache.seq[n]++;
+  release(&dcache.lock);
+}
+
+// Forget every name cached for dp, which is being freed
+// and whose inode number may soon name another directory.
+static void
+dcforget(struct inode *dp)
+{
+  struct dentry *e;
+  uint n;
+
+  acquire(&dcache.lock);
+  for(e = dcache.ent; e < &dcache.ent[NDCACHE]; e++){
+    if(e->dinum == dp->inum && e->dev == dp->dev){
+      n = (e - dcache.ent) / DCWAYS;
+      dcache.seq[n]++;
+      __sync_synchronize();
+      e->dinum = 0;
+      __sync_synchronize();
+      dcache.seq[n]++;
+    }
+  }
+  release(&dcache.lock);
+}
+
 // Look for a directory entry in a directory.
 // If found, set *poff to byte offset of entry.
 struct inode*
@@ -544,7 +2273,19 @@ dirlookup(struct inode *dp, char *name, uint *poff)
   if(dp->type != T_DIR)
     panic("dirlookup not DIR");
 
+  // Callers that want the offset mean to change the entry.
+  if(poff == 0 && dclookup(dp, name, &inum))
+    return inum ? iget(dp->dev, inum) : 0;
+
+  if(dp->minor & IF_DIRHASH){
+    inum = dhlookup(dp, name, poff);
+    dcupdate(dp, name, inum);
+    return inum ? iget(dp->dev, inum) : 0;
+  }
+
   for(off = 0; off < dp->size; off += sizeof(de)){
+    if(off % BSIZE == 0)
+      fsstats.dirblocks++;
     if(readi(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
       panic("dirlookup read");
     if(de.inum == 0)
@@ -554,10 +2295,12 @@ dirlookup(struct inode *dp, char *name, uint *poff)
       if(poff)
         *poff = off;
       inum = de.inum;
+      dcupdate(dp, name, inum);
       return iget(dp->dev, inum);
     }
   }
 
+  dcupdate(dp, name, 0);
   return 0;
 }
 
@@ -566,6 +2309,7 @@ int
 dirlink(struct inode *dp, char *name, uint inum)
 {
   int off;
+  uint n;
   struct dirent de;
   struct inode *ip;
 
@@ -575,6 +2319,20 @@ dirlink(struct inode *dp, char *name, uint inum)
     return -1;
   }
 
+  if(dp->minor & IF_DIRHASH){
+    memset(&de, 0, sizeof(de));
+    strncpy(de.name, name, DIRSIZ);
+    de.inum = inum;
+    n = dhbuckets(dp);
+    // Split a bucket if a chain grew, or there are so many
+    // blocks per bucket that chains soon will.
+    if(dhinsert(dp, dhome(dhash(de.name), n), &de) ||
+       dp->size / BSIZE > n + n/4)
+      dirwork(dp);
+    dcupdate(dp, name, inum);
+    return 0;
+  }
+
   // Look for an empty dirent.
   for(off = 0; off < dp->size; off += sizeof(de)){
     if(readi(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
@@ -583,14 +2341,79 @@ dirlink(struct inode *dp, char *name, uint inum)
       break;
   }
 
+  // Hash the directory once it needs a block past DIRHASH bytes.
+  if(DIRHASH > 0 && off >= DIRHASH && off == dp->size && off % BSIZE == 0)
+    dirwork(dp);
+
   strncpy(de.name, name, DIRSIZ);
   de.inum = inum;
   if(writei(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
     panic("dirlink");
+  dcupdate(dp, name, inum);
 
   return 0;
 }
 
+// Copy up to n entries of directory dp, starting at byte *off,
+// with their inodes' stat data to out, and advance *off past
+// them.  Returns how many, 0 at the end.  Owner names are looked
+// up once per run of entries with the same owner.  If excl, dp is
+// locked exclusively, since *off is shared and the lock guards it.
+// Must be called inside a transaction since it calls iput().
+int
+dirlist(struct inode *dp, uint *off, struct direntplus *out, int n, int excl)
+{
+  struct inode *ips[NDIRLIST], *ip;
+  struct dirent de;
+  char oname[sizeof(out->owner_name)];
+  uint owner;
+  int i, k;
+
+  if(n > NDIRLIST)
+    n = NDIRLIST;
+
+  // Take references to the entries' inodes while dp is locked,
+  // so none of them can be freed, but lock them only after:
+  // ".." is dp's parent, which must not be locked under dp.
+  if(excl)
+    ilock(dp);
+  else
+    ilockshared(dp);
+  if(dp->type != T_DIR){
+    iunlock(dp);
+    return -1;
+  }
+  for(k = 0; k < n && *off + sizeof(de) <= dp->size; *off += sizeof(de)){
+    if(readi(dp, (char*)&de, *off, sizeof(de)) != sizeof(de))
+      break;
+    if(de.inum == 0)
+      continue;
+    memmove(out[k].name, de.name, DIRSIZ);
+    ips[k++] = iget(dp->dev, de.inum);
+  }
+  iunlock(dp);
+
+  owner = 0;
+  for(i = 0; i < k; i++){
+    ip = ips[i];
+    ilockshared(ip);
+    out[i].perm = ip->perm;
+    out[i].type = ip->type;
+    out[i].ino = ip->inum;
+    out[i].nlink = ip->nlink;
+    out[i].size = ip->size;
+    out[i].owner = ip->owner;
+    iunlockput(ip);
+    if(i == 0 || out[i].owner != owner){
+      owner = out[i].owner;
+      if(get_username_with_uid(owner, oname) != 0)
+        oname[0] = '\0';
+    }
+    memmove(out[i].owner_name, oname, sizeof(oname));
+  }
+  return k;
+}
+
 //PAGEBREAK!
 // Paths
 
@@ -631,6 +2454,106 @@ skipelem(char *path, char *name)
   return path;
 }
 
+// Optimistic path lookup.
+//
+// namefast() walks a path through the name cache and the inode
+// cache without taking icache.lock, dcache.lock or any inode's
+// sleeplock, so lookups from many CPUs do not contend.  Instead
+// it reads each directory's seq before and after looking at it:
+// ilock() makes seq odd and iunlock() even again, and iget()
+// changes it when the entry is recycled, so if it was even and
+// is the same, nothing changed the directory in between.  Only
+// the inode it returns gets a reference, from iget().  A name or
+// inode not cached, or any change, makes it give up, and namex()
+// takes the locked path.
+
+#define NFASTSTEPS  16  // hash chain entries ifast() looks at
+
+// Find the cached inode (dev, inum) without icache.lock.
+// The caller must check that it is still that inode.
+static struct inode*
+ifast(uint dev, uint inum)
+{
+  struct inode *ip;
+  int n;
+
+  n = 0;
+  for(ip = *ihash(dev, inum); ip != 0 && n < NFASTSTEPS; ip = ip->hnext, n++)
+    if(ip->dev == dev && ip->inum == inum)
+      return ip;
+  return 0;
+}
+
+// If ip holds valid inode (dev, inum) and no one is changing
+// it, set *s to its seq and return 1.
+static int
+iseqbegin(struct inode *ip, uint dev, uint inum, uint *s)
+{
+  *s = ip->seq;
+  __sync_synchronize();
+  if(*s & 1)
+    return 0;
+  return ip->dev == dev && ip->inum == inum && ip->valid;
+}
+
+// Did ip stay as it was when iseqbegin() returned s?
+static int
+iseqok(struct inode *ip, uint s)
+{
+  __sync_synchronize();
+  return ip->seq == s;
+}
+
+// Like namex(), but returns 0 whenever it cannot be sure,
+// so the caller must then call namex().
+static struct inode*
+namefast(char *path, int nameiparent, char *name)
+{
+  struct inode *dp, *ip;
+  uint dev, inum, next, s, t;
+
+  if(*path == '/'){
+    dev = ROOTDEV;
+    inum = ROOTINO;
+    if((dp = ifast(dev, inum)) == 0)
+      return 0;
+  } else {
+    // The process's reference keeps cwd's identity.
+    dp = myproc()->cwd;
+    dev = dp->dev;
+    inum = dp->inum;
+  }
+  if(!iseqbegin(dp, dev, inum, &s))
+    return 0;
+
+  while((path = skipelem(path, name)) != 0){
+    if(dp->type != T_DIR || has_execute_permission(dp) == 0)
+      return 0;
+    if(nameiparent && *path == '\0')
+      break;
+    if(!dcfast(dev, inum, name, &next) || next == 0)
+      return 0;
+    if((ip = ifast(dev, next)) == 0 || !iseqbegin(ip, dev, next, &t))
+      return 0;
+    // ip was dp's entry for name if dp has not changed.
+    if(!iseqok(dp, s))
+      return 0;
+    dp = ip;
+    inum = next;
+    s = t;
+  }
+  if(nameiparent && path == 0)
+    return 0;
+
+  ip = iget(dev, inum);
+  if(ip != dp || !iseqok(dp, s)){
+    iput(ip);
+    return 0;
+  }
+  fsstats.fastlookups++;
+  return ip;
+}
+
 // Look up and return the inode for a path name.
 // If parent != 0, return the inode for the parent and copy the final
 // path element into name, which must have room for DIRSIZ bytes.
@@ -640,13 +2563,17 @@ namex(char *path, int nameiparent, char *name)
 {
   struct inode *ip, *next;
 
+  if((ip = namefast(path, nameiparent, name)) != 0)
+    return ip;
+  fsstats.slowlookups++;
+
   if(*path == '/')
     ip = iget(ROOTDEV, ROOTINO);
   else
     ip = idup(myproc()->cwd);
 
   while((path = skipelem(path, name)) != 0){
-    ilock(ip);
+    ilockshared(ip);
     if(ip->type != T_DIR){
       iunlockput(ip);
       return 0;
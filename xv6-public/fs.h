@@ -3,7 +3,9 @@
 
 
 #define ROOTINO 1  // root i-number
-#define BSIZE 512  // block size
+#ifndef BSIZE
+#define BSIZE 512  // block size: a multiple of 512, at most 4096
+#endif
 
 // Disk layout:
 // [ boot block | super block | log | inode blocks |
@@ -19,21 +21,44 @@ struct superblock {
   uint logstart;     // Block number of first log block
   uint inodestart;   // Block number of first inode block
   uint bmapstart;    // Block number of first free map block
+  uint bsize;        // Block size in bytes; 0 in old images means 512
 };
 
-#define NDIRECT 11
+#define NDIRECT 10
 #define NINDIRECT (BSIZE / sizeof(uint))
-#define MAXFILE (NDIRECT + NINDIRECT)
+#define NDINDIRECT (NINDIRECT * NINDIRECT)
+#define MAXFILE (NDIRECT + NINDIRECT + NDINDIRECT)
+
+// An extent maps len blocks of a file, from block lbn of the
+// file on, to the disk blocks from start on.
+struct extent {
+  uint lbn;
+  uint start;
+  uint len;
+};
+
+// Extents that fit in addrs[], and in an extent block.
+#define NIEXT ((NDIRECT+2) * sizeof(uint) / sizeof(struct extent))
+#define EPB (BSIZE / sizeof(struct extent))
+
+// Flags kept in minor of an inode that is not a device.
+#define IF_EXTENTS 0x1  // addrs[] holds extents, not block numbers
+#define IF_EXTBLK  0x2  // ... of extent blocks that hold the extents
+#define IF_INLINE  0x4  // addrs[] holds the file's data itself
+#define IF_DIRHASH 0x8  // directory is a hash table (see fs.c)
+
+// Bytes of data an IF_INLINE inode holds.
+#define NINLINE ((NDIRECT+2) * sizeof(uint))
 
 // On-disk inode structure
 struct dinode {
   char perm;            // Permission
   char type;            // File type
   short major;          // Major device number (T_DEV only)
-  short minor;          // Minor device number (T_DEV only)
+  short minor;          // Minor device number (T_DEV); else IF_ flags
   short nlink;          // Number of links to inode in file system
   uint size;            // Size of file (bytes)
-  uint addrs[NDIRECT+1];   // Data block addresses
+  uint addrs[NDIRECT+2];   // Data block addresses
   uint owner;           // owner uid
 };
 
@@ -57,6 +82,22 @@ struct dirent {
   char name[DIRSIZ];
 };
 
+// Directory entries per block.
+#define DPB (BSIZE / sizeof(struct dirent))
+
+// First entry of each block of a hashed directory.  Its inum
+// is 0, so programs reading the directory as dirents skip it.
+struct dirhead {
+  ushort zero;      // inum; always 0
+  ushort magic;     // DH_MAGIC
+  ushort bucket;    // bucket whose chain this block is in
+  ushort next;      // next block in the chain, or 0
+  uint nbuckets;    // in block 0: number of buckets
+  uint unused;
+};
+
+#define DH_MAGIC 0xd1a5
+
 // File Permission Mode
 
 #define MODE_RUSR 32 // owner read
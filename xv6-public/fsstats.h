@@ -0,0 +1,23 @@
+// File system counters, returned by the fsstats() system call.
+struct fsstats {
+  uint commits;    // transactions committed
+  uint logwrites;  // blocks written to the log, headers included
+  uint zerorecs;   // blocks logged as zero records, without a log block
+  uint installs;   // blocks written from the log to home locations
+  uint directwrites;  // file blocks written around the log
+  uint ballocs;    // blocks allocated
+  uint bmapscans;  // bitmap blocks the allocator looked at
+  uint iallocs;    // inodes allocated
+  uint iscans;     // inode blocks ialloc() looked at
+  uint delayed;    // file blocks allocated late, by idelayflush()
+  uint goalmisses; // blocks not allocated right after the file's last one
+  uint breads;     // bread() calls
+  uint iwrites;    // inodes copied to their blocks
+  uint ireads;     // inodes read from their blocks by ilock()
+  uint dirblocks;  // directory blocks dirlookup() looked at
+  uint dirsplits;  // hashed directory buckets split
+  uint dchits;     // dirlookup() calls answered by the name cache
+  uint dcmisses;   // dirlookup() calls that had to read the directory
+  uint fastlookups; // paths namefast() resolved without locks
+  uint slowlookups; // paths namex() resolved with locks
+};
@@ -1,4 +1,6 @@
-// Simple PIO-based (non-DMA) IDE driver code.
+// Simple IDE driver code.
+// Uses bus-master DMA when the PCI IDE controller supports it
+// and falls back to programmed I/O (insl/outsl) otherwise.
 
 #include "types.h"
 #include "defs.h"
@@ -12,6 +14,7 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "pci.h"
 
 #define SECTOR_SIZE   512
 #define IDE_BSY       0x80
@@ -23,6 +26,33 @@
 #define IDE_CMD_WRITE 0x30
 #define IDE_CMD_RDMUL 0xc4
 #define IDE_CMD_WRMUL 0xc5
+#define IDE_CMD_RDDMA 0xc8
+#define IDE_CMD_WRDMA 0xca
+#define IDE_CMD_SETMUL 0xc6
+#define IDE_CMD_IDENTIFY 0xec
+
+#define LBA28_SECTORS (1 << 28)  // sectors a 28-bit address can reach
+
+// Bus master IDE registers, as offsets from the controller's BAR4.
+// The primary channel (the one holding both of our disks) comes first.
+#define BM_CMD        0
+#define BM_STATUS     2
+#define BM_PRDT       4
+
+#define BM_CMD_START  0x01
+#define BM_CMD_READ   0x08  // transfer from disk to memory
+#define BM_ST_ERR     0x02
+#define BM_ST_INTR    0x04
+
+// Physical region descriptor: one contiguous piece of a transfer.
+// A region may not cross a 64KB boundary.
+struct prd {
+  uint addr;
+  ushort len;
+  ushort flags;
+};
+#define PRD_EOT       0x8000  // last descriptor in the table
+#define NPRD          (BSIZE/SECTOR_SIZE + 1)
 
 // idequeue points to the buf now being read/written to the disk.
 // idequeue->qnext points to the next buf to be processed.
@@ -32,8 +62,13 @@ static struct spinlock idelock;
 static struct buf *idequeue;
 
 static int havedisk1;
+static uint nsectors[2];  // size of each disk, from IDENTIFY; 0 if unknown
 static void idestart(struct buf*);
 
+// Bus master I/O base, or 0 to use programmed I/O.
+static ushort bmbase;
+static struct prd prdt[NPRD] __attribute__((aligned(32)));
+
 // Wait for IDE disk to become ready.
 static int
 idewait(int checkerr)
@@ -47,6 +82,63 @@ idewait(int checkerr)
   return 0;
 }
 
+// Return how many sectors disk d can address with LBA28,
+// or 0 if it does not answer IDENTIFY.
+static uint
+ideidentify(int d)
+{
+  uint id[SECTOR_SIZE/4];
+
+  outb(0x1f6, 0xe0 | (d<<4));
+  outb(0x1f7, IDE_CMD_IDENTIFY);
+  if(inb(0x1f7) == 0 || idewait(1) < 0)
+    return 0;
+  insl(0x1f0, id, SECTOR_SIZE/4);
+  return id[30];  // words 60 and 61
+}
+
+// Look for a bus-master capable PCI IDE controller
+// (class 1, subclass 1, prog-if bit 7).
+static void
+ideinitdma(void)
+{
+#ifndef IDEPIO
+  struct pcidev *d;
+
+  if((d = pcifindclass(0x01, 0x01)) == 0 || (d->progif & 0x80) == 0)
+    return;
+  if((d->bar[4] & 1) == 0 || PCI_BAR_IO(d->bar[4]) == 0)
+    return;
+  pcienable(d);
+  bmbase = PCI_BAR_IO(d->bar[4]);
+  outb(bmbase + BM_CMD, 0);
+  outb(bmbase + BM_STATUS, BM_ST_ERR | BM_ST_INTR);
+  cprintf("ide: bus-master DMA at port 0x%x\n", bmbase);
+#endif
+}
+
+// Describe b->data in the PRD table, splitting it
+// wherever it crosses a 64KB physical boundary.
+static void
+prdfill(struct buf *b)
+{
+  uint pa, n, end;
+  struct prd *p;
+
+  pa = V2P(b->data);
+  end = pa + BSIZE;
+  for(p = prdt; pa < end; p++){
+    n = end - pa;
+    if(((pa & 0xffff) + n) > 0x10000)
+      n = 0x10000 - (pa & 0xffff);
+    p->addr = pa;
+    p->len = n;
+    p->flags = 0;
+    pa += n;
+  }
+  p[-1].flags = PRD_EOT;
+}
+
 void
 ideinit(void)
 {
@@ -65,8 +157,24 @@ ideinit(void)
     }
   }
 
+  if(havedisk1 && (nsectors[1] = ideidentify(1)) != 0)
+    cprintf("ide: disk 1 has %d sectors\n", nsectors[1]);
+
+  // Have disk 1 move a whole block per interrupt when it
+  // reads or writes several sectors with PIO.
+  if(havedisk1 && BSIZE/SECTOR_SIZE > 1){
+    outb(0x1f6, 0xe0 | (1<<4));
+    idewait(0);
+    outb(0x1f2, BSIZE/SECTOR_SIZE);
+    outb(0x1f7, IDE_CMD_SETMUL);
+    if(idewait(1) < 0)
+      panic("ideinit: multiple mode");
+  }
+
   // Switch back to disk 0.
   outb(0x1f6, 0xe0 | (0<<4));
+
+  ideinitdma();
 }
 
 // Start the request for b.  Caller must hold idelock.
@@ -75,15 +183,15 @@ idestart(struct buf *b)
 {
   if(b == 0)
     panic("idestart");
-  if(b->blockno >= FSSIZE)
-    panic("incorrect blockno");
   int sector_per_block =  BSIZE/SECTOR_SIZE;
+  if(b->blockno >= LBA28_SECTORS/sector_per_block)
+    panic("incorrect blockno");
   int sector = b->blockno * sector_per_block;
+  if(nsectors[b->dev&1] && sector + sector_per_block > nsectors[b->dev&1])
+    panic("idestart: past end of disk");
   int read_cmd = (sector_per_block == 1) ? IDE_CMD_READ :  IDE_CMD_RDMUL;
   int write_cmd = (sector_per_block == 1) ? IDE_CMD_WRITE : IDE_CMD_WRMUL;
 
-  if (sector_per_block > 7) panic("idestart");
-
   idewait(0);
   outb(0x3f6, 0);  // generate interrupt
   outb(0x1f2, sector_per_block);  // number of sectors
@@ -91,7 +199,14 @@ idestart(struct buf *b)
   outb(0x1f4, (sector >> 8) & 0xff);
   outb(0x1f5, (sector >> 16) & 0xff);
   outb(0x1f6, 0xe0 | ((b->dev&1)<<4) | ((sector>>24)&0x0f));
-  if(b->flags & B_DIRTY){
+  if(bmbase){
+    prdfill(b);
+    outl(bmbase + BM_PRDT, V2P(prdt));
+    outb(bmbase + BM_CMD, (b->flags & B_DIRTY) ? 0 : BM_CMD_READ);
+    outb(bmbase + BM_STATUS, BM_ST_ERR | BM_ST_INTR);
+    outb(0x1f7, (b->flags & B_DIRTY) ? IDE_CMD_WRDMA : IDE_CMD_RDDMA);
+    outb(bmbase + BM_CMD, inb(bmbase + BM_CMD) | BM_CMD_START);
+  } else if(b->flags & B_DIRTY){
     outb(0x1f7, write_cmd);
     outsl(0x1f0, b->data, BSIZE/4);
   } else {
@@ -104,6 +219,7 @@ void
 ideintr(void)
 {
   struct buf *b;
+  uchar st;
 
   // First queued buffer is the active request.
   acquire(&idelock);
@@ -112,10 +228,31 @@ ideintr(void)
     release(&idelock);
     return;
   }
+
+  if(bmbase){
+    st = inb(bmbase + BM_STATUS);
+    if((st & (BM_ST_ERR|BM_ST_INTR)) == 0){
+      // Transfer still in progress; not our interrupt.
+      release(&idelock);
+      return;
+    }
+    // Stop the engine and acknowledge the interrupt at both the
+    // controller and the drive (idewait reads the drive status).
+    outb(bmbase + BM_CMD, 0);
+    outb(bmbase + BM_STATUS, BM_ST_ERR | BM_ST_INTR);
+    if((st & BM_ST_ERR) || idewait(1) < 0){
+      // Give up on DMA and redo this request with PIO.
+      cprintf("ide: DMA error, falling back to PIO\n");
+      bmbase = 0;
+      idestart(b);
+      release(&idelock);
+      return;
+    }
+  }
   idequeue = b->qnext;
 
   // Read data if needed.
-  if(!(b->flags & B_DIRTY) && idewait(1) >= 0)
+  if(!bmbase && !(b->flags & B_DIRTY) && idewait(1) >= 0)
     insl(0x1f0, b->data, BSIZE/4);
 
   // Wake process waiting for this buf.
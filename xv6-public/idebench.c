@@ -0,0 +1,153 @@
+// Estimate how much CPU time the kernel spends per megabyte
+// of disk traffic.  A spinner process counts loop iterations
+// while this process reads and rewrites files bigger than the
+// buffer cache; iterations the spinner loses compared to an idle
+// run are CPU time that went to the disk path.
+//
+// Run under "make qemu CPUS=1" so both compete for one CPU, once
+// with the default kernel (DMA) and once built with IDEPIO=1.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+
+#define NFILES  2     // files, so the total can exceed NBUF
+#define NBLK    100   // file size in 512-byte blocks; NFILES*NBLK > NBUF
+#define WINDOW  300   // ticks per measurement
+
+char buf[512];
+char *files[NFILES] = { "idebench.0", "idebench.1" };
+
+// Spin for n ticks, then write the iteration count to fd.
+void
+spin(int fd, int n)
+{
+  volatile int x;
+  int start, count, i;
+
+  count = 0;
+  start = uptime();
+  while(uptime() - start < n){
+    for(i = 0; i < 10000; i++)
+      x++;
+    count++;
+  }
+  write(fd, &count, sizeof(count));
+  close(fd);
+  exit();
+}
+
+// Start a spinner for WINDOW ticks; return the read end of its pipe.
+int
+startspin(void)
+{
+  int p[2];
+
+  if(pipe(p) < 0){
+    printf(1, "idebench: pipe failed\n");
+    exit();
+  }
+  if(fork() == 0){
+    close(p[0]);
+    spin(p[1], WINDOW);
+  }
+  close(p[1]);
+  return p[0];
+}
+
+int
+endspin(int fd)
+{
+  int n;
+
+  if(read(fd, &n, sizeof(n)) != sizeof(n))
+    n = 0;
+  close(fd);
+  wait();
+  return n;
+}
+
+// Read or rewrite all the files once.
+int
+pass(int writing)
+{
+  int fd, f, i;
+
+  for(f = 0; f < NFILES; f++){
+    fd = open(files[f], writing ? O_WRONLY : O_RDONLY);
+    if(fd < 0){
+      printf(1, "idebench: open %s failed\n", files[f]);
+      exit();
+    }
+    for(i = 0; i < NBLK; i++){
+      if(writing){
+        buf[0] = i;
+        if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+          printf(1, "idebench: write failed\n");
+          exit();
+        }
+      } else if(read(fd, buf, sizeof(buf)) != sizeof(buf)){
+        printf(1, "idebench: read failed\n");
+        exit();
+      }
+    }
+    close(fd);
+  }
+  return NFILES * NBLK * sizeof(buf) / 1024;
+}
+
+void
+measure(char *what, int writing, int idle)
+{
+  int fd, start, kb, spun, busy;
+
+  fd = startspin();
+  kb = 0;
+  start = uptime();
+  while(uptime() - start < WINDOW)
+    kb += pass(writing);
+  spun = endspin(fd);
+
+  // Ticks of the window the spinner did not get.
+  busy = WINDOW - WINDOW * spun / idle;
+  if(busy < 0)
+    busy = 0;
+  printf(1, "%s: %d KB in %d ticks, cpu %d ticks, %d.%d ticks/MB\n",
+         what, kb, WINDOW, busy,
+         busy * 1024 / kb, (busy * 10240 / kb) % 10);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int fd, f, i, idle;
+
+  printf(1, "idebench starting\n");
+
+  memset(buf, 'x', sizeof(buf));
+  for(f = 0; f < NFILES; f++){
+    unlink(files[f]);
+    fd = open(files[f], O_CREATE | O_RDWR);
+    if(fd < 0){
+      printf(1, "idebench: create failed\n");
+      exit();
+    }
+    for(i = 0; i < NBLK; i++)
+      write(fd, buf, sizeof(buf));
+    close(fd);
+  }
+
+  idle = endspin(startspin());
+  if(idle < 100){
+    printf(1, "idebench: calibration failed\n");
+    exit();
+  }
+
+  measure("read", 0, idle);
+  measure("write", 1, idle);
+
+  for(f = 0; f < NFILES; f++)
+    unlink(files[f]);
+  exit();
+}
@@ -73,3 +73,21 @@ ioapicenable(int irq, int cpunum)
   ioapicwrite(REG_TABLE+2*irq, T_IRQ0 + irq);
   ioapicwrite(REG_TABLE+2*irq+1, cpunum << 24);
 }
+
+// Like ioapicenable(), for a PCI INTx line, which is
+// level-triggered: an edge would be lost if the device
+// raised the line again before the handler lowered it.
+// INTx is active low, but the chipset's PCI interrupt
+// router presents it on the ISA inputs (irq < 16)
+// active high; only inputs 16 and up see it as is.
+void
+ioapicenablepci(int irq, int cpunum)
+{
+  uint flags;
+
+  flags = INT_LEVEL;
+  if(irq >= 16)
+    flags |= INT_ACTIVELOW;
+  ioapicwrite(REG_TABLE+2*irq, flags | (T_IRQ0 + irq));
+  ioapicwrite(REG_TABLE+2*irq+1, cpunum << 24);
+}
@@ -1,10 +1,13 @@
 #include "types.h"
 #include "defs.h"
 #include "param.h"
+#include "mmu.h"
+#include "proc.h"
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "fsstats.h"
 
 // Simple logging that allows concurrent FS system calls.
 //
@@ -15,44 +18,149 @@
 // write an uncommitted system call's updates to disk.
 //
 // A system call should call begin_op()/end_op() to mark
-// its start and end. Usually begin_op() just increments
-// the count of in-progress FS system calls and returns.
-// But if it thinks the log is close to running out, it
-// sleeps until the last outstanding end_op() commits.
+// its start and end, passing begin_op() the most blocks it
+// may write. Usually begin_op() just reserves that much log
+// space and returns. But if the reservations of the
+// in-progress FS system calls and what the transaction
+// already holds leave too little, it sleeps until the last
+// outstanding end_op() commits. Room for iput() to free an
+// inode is added to every reservation.
 //
-// The log is a physical re-do log containing disk blocks.
+// A process can group several FS system calls into one
+// operation with txn_begin()/txn_end() (the fs_txn_begin and
+// fs_txn_end system calls), so they commit together. The group
+// reserves TXNBLOCKS up front; the calls inside it draw on that
+// instead of waiting for log space. If they need more, the group
+// is committed and continues in a new reservation, and
+// txn_end() reports that it was not atomic. Between the calls
+// of a group its process may block or spin in user space, so
+// there the group is parked: it keeps its reservation, but
+// commits go ahead without it, as when another operation ends
+// or the running transaction has waited TXNTICKS for it. That
+// commits part of the group, so it is not atomic either.
+//
+// The log is double-buffered. When the last end_op() of a
+// transaction commits, it first freezes the transaction:
+// copies every logged block into a private staging buffer
+// (logbuf[]) while begin_op() is held off. From then on the
+// commit works only on those copies, so the next transaction
+// can start and modify the same cached blocks while the
+// previous one is still being written. Only one transaction
+// is written at a time; the next one waits for it in end_op().
+//
+// Installing is deferred. A commit appends the transaction's
+// blocks after those of earlier, not yet installed transactions
+// and rewrites the header to cover them all. The blocks stay
+// pinned in the buffer cache, and their staging copies stay in
+// logbuf[], until the flusher thread checkpoints: it installs
+// everything in the log to home locations in one batch and then
+// clears the header. It does so every CKPTTICKS ticks, when the
+// log is half full, and a commit that finds no room left
+// checkpoints itself.
+//
+// Blocks are logged as byte ranges. log_write_range() records
+// which bytes of a block an operation changed; a transaction
+// keeps one bounding range per block, so a one-bit bitmap change
+// or one dinode update logs a few bytes rather than the block.
+// At commit the ranges are packed back to back into the log
+// blocks, and installing reads the home block, applies the
+// ranges in order and writes it back. A range covering the
+// whole block needs no read, and a whole block that is all
+// zeros is logged as a record with no data at all.
+//
+// Commits are synchronous by default: the last operation of
+// a transaction commits before end_op() returns. Built with
+// COMMITTICKS > 0 they are asynchronous: end_op() returns at
+// once, and the flusher commits every COMMITTICKS ticks. An
+// operation commits itself when the log is too full for
+// another, or when sync() or fsync() is waiting; those two
+// return once everything that finished before them is
+// committed.
+//
+// Crash consistency: after a crash and recovery, the file
+// system is as it was after some committed transaction. Each
+// transaction is applied whole or not at all, and in order.
+// With asynchronous commit, operations from about the last
+// COMMITTICKS ticks before the crash may be lost, unless a
+// sync() or fsync() covering them returned. Data streamed by
+// writeidirect() is written before the transaction that links
+// it into a file. But an overwrite in place of existing blocks
+// can survive a crash that loses its transaction.
+//
+// The log is a physical re-do log.
 // The on-disk log format:
-//   header block, containing block #s for block A, B, C, ...
-//   block A
-//   block B
-//   block C
-//   ...
-// Log appends are synchronous.
+//   header block, containing a record for each logged range:
+//     home block #, offset and length
+//   the ranges' bytes, packed into as many blocks as they need
+// Log appends are synchronous. A block may appear more than
+// once; recovery applies records in order, so the last wins.
+
+// A logged range. len == 0 means the whole block is zeros.
+struct logrec {
+  uint blockno;
+  ushort off;
+  ushort len;
+};
 
 // Contents of the header block, used for both the on-disk header block
-// and to keep track in memory of logged block# before commit.
+// and to keep track in memory of logged ranges before commit.
 struct logheader {
   int n;
-  int block[LOGSIZE];
+  struct logrec rec[NLOGREC];
 };
 
+#define CKPTTICKS  100  // longest a committed block waits to be installed
+#define NFREED      64  // freed blocks remembered per transaction
+
 struct log {
   struct spinlock lock;
   int start;
   int size;
+  int cap;         // bytes of range data the log can hold
+  int freeres;     // blocks iput() may write freeing an inode
   int outstanding; // how many FS sys calls are executing.
-  int committing;  // in commit(), please wait.
+  int parked;      // of which are groups between calls
+  uint opened;     // ticks when the running transaction began
+  int reserved;    // blocks reserved by the executing FS sys calls
+  int committing;  // log I/O (commit or checkpoint) in progress; wait.
+  int freezing;    // copying the closing transaction; wait to begin.
+  int kick;        // ask the flusher to checkpoint now.
+  int commitwant;  // someone wants the running transaction committed.
+  int seq;         // number of the running transaction
+  int done;        // last transaction whose commit has finished
   int dev;
-  struct logheader lh;
+  int nbytes;      // range bytes in the running transaction
+  int nrec;        // records in clh, with any being committed
+  int nfreed;      // blocks freed by the running transaction;
+  uint freed[NFREED]; // > NFREED if there were too many to list
+  struct logheader lh;  // the running transaction
 };
 struct log log;
 
+// Ranges committed to the on-disk log but not yet installed,
+// and a copy of their bytes, cbytes of them, packed as on disk.
+// Only the process holding log.committing uses these.
+static struct logheader clh;
+static int cbytes;
+static int ncfreed;  // blocks freed by the transaction being committed
+static uint cfreed[NFREED];
+static struct buf logbuf[LOGSIZE];
+static struct buf ibuf;  // assembles a block being installed
+
+struct fsstats fsstats;
+
 static void recover_from_log(void);
-static void commit();
+static void commit(int, int);
+static void commit_running(void);
+static void flusher(void);
+static void txn_park(void);
+static void txn_unpark(void);
 
 void
 initlog(int dev)
 {
+  int i;
+
   if (sizeof(struct logheader) >= BSIZE)
     panic("initlog: too big logheader");
 
@@ -62,51 +170,128 @@ initlog(int dev)
   log.start = sb.logstart;
   log.size = sb.nlog;
   log.dev = dev;
+  if (log.size - 1 > LOGSIZE)
+    cprintf("log: using %d of %d log blocks\n", LOGSIZE, log.size - 1);
+  log.cap = (log.size - 1 < LOGSIZE ? log.size - 1 : LOGSIZE) * BSIZE;
+  log.freeres = sb.size/BPB + 2;  // bitmap blocks and the inode
+  if (log.cap < (MAXOPBLOCKS + log.freeres) * BSIZE)
+    panic("initlog: log too small");
+  for (i = 0; i < LOGSIZE; i++) {
+    initsleeplock(&logbuf[i].lock, "logbuf");
+    logbuf[i].dev = dev;
+  }
+  initsleeplock(&ibuf.lock, "ibuf");
+  ibuf.dev = dev;
+  log.seq = 1;
   recover_from_log();
+  kthread("flusher", flusher);
+}
+
+// Read or write staging buffer b at disk block blockno.
+static void
+logio(struct buf *b, uint blockno, int write)
+{
+  acquiresleep(&b->lock);
+  b->blockno = blockno;
+  b->flags = write ? B_VALID|B_DIRTY : 0;
+  diskrw(b);
+  releasesleep(&b->lock);
+}
+
+// Copy n bytes between p and the packed range data at pos.
+static void
+logcopy(uint pos, uchar *p, int n, int tolog)
+{
+  uchar *q;
+  int m;
+
+  for (; n > 0; pos += m, p += m, n -= m) {
+    q = logbuf[pos/BSIZE].data + pos%BSIZE;
+    m = BSIZE - pos%BSIZE;
+    if (m > n)
+      m = n;
+    if (tolog)
+      memmove(q, p, m);
+    else
+      memmove(p, q, m);
+  }
 }
 
-// Copy committed blocks from log to their home location
+// Write each committed block to its home location, applying
+// its ranges in order to the block as the disk has it, or to
+// the last whole-block record. If unpin, also drop the cache
+// pin log_write_range() took.
 static void
-install_trans(void)
+install_trans(int unpin)
 {
-  int tail;
+  uint pos[NLOGREC], blockno;
+  int tail, i, first;
+
+  pos[0] = 0;
+  for (tail = 1; tail < clh.n; tail++)
+    pos[tail] = pos[tail-1] + clh.rec[tail-1].len;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
-    struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
-    memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
-    bwrite(dbuf);  // write dst to disk
-    brelse(lbuf);
-    brelse(dbuf);
+  for (tail = 0; tail < clh.n; tail++) {
+    blockno = clh.rec[tail].blockno;
+    for (i = tail+1; i < clh.n; i++)
+      if (clh.rec[i].blockno == blockno)
+        break;
+    if (i == clh.n) {  // install each block once, at its last record
+      first = tail;
+      for (i = tail; i >= 0; i--) {
+        if (clh.rec[i].blockno != blockno)
+          continue;
+        first = i;
+        if (clh.rec[i].len == 0 || clh.rec[i].len == BSIZE)
+          break;
+      }
+      if (i < 0)
+        logio(&ibuf, blockno, 0);  // read dst; ranges go on top
+      for (i = first; i <= tail; i++) {
+        if (clh.rec[i].blockno != blockno)
+          continue;
+        if (clh.rec[i].len == 0)
+          memset(ibuf.data, 0, BSIZE);
+        else
+          logcopy(pos[i], ibuf.data + clh.rec[i].off, clh.rec[i].len, 0);
+      }
+      logio(&ibuf, blockno, 1);  // write dst to disk
+      fsstats.installs++;
+    }
+    if (unpin) {
+      struct buf *dbuf = bread(log.dev, blockno); // pinned; no I/O
+      bunpin(dbuf);
+      brelse(dbuf);
+    }
   }
 }
 
-// Read the log header from disk into the in-memory log header
+// Read the log header from disk into clh
 static void
 read_head(void)
 {
   struct buf *buf = bread(log.dev, log.start);
   struct logheader *lh = (struct logheader *) (buf->data);
   int i;
-  log.lh.n = lh->n;
-  for (i = 0; i < log.lh.n; i++) {
-    log.lh.block[i] = lh->block[i];
+  clh.n = lh->n;
+  for (i = 0; i < clh.n; i++) {
+    clh.rec[i] = lh->rec[i];
   }
   brelse(buf);
 }
 
-// Write in-memory log header to disk.
+// Write the frozen header to disk.
 // This is the true point at which the
-// current transaction commits.
+// frozen transaction commits.
 static void
 write_head(void)
 {
   struct buf *buf = bread(log.dev, log.start);
   struct logheader *hb = (struct logheader *) (buf->data);
   int i;
-  hb->n = log.lh.n;
-  for (i = 0; i < log.lh.n; i++) {
-    hb->block[i] = log.lh.block[i];
+  hb->n = clh.n;
+  for (i = 0; i < clh.n; i++) {
+    hb->rec[i] = clh.rec[i];
   }
   bwrite(buf);
   brelse(buf);
@@ -115,120 +300,503 @@ write_head(void)
 static void
 recover_from_log(void)
 {
+  int i;
+
   read_head();
-  install_trans(); // if committed, copy from log to disk
-  log.lh.n = 0;
+  cbytes = 0;
+  for (i = 0; i < clh.n; i++)
+    cbytes += clh.rec[i].len;
+  for (i = 0; i*BSIZE < cbytes; i++)
+    logio(&logbuf[i], log.start+i+1, 0);  // read log block
+  install_trans(0); // if committed, copy from log to disk
+  clh.n = 0;
+  cbytes = 0;
   write_head(); // clear the log
 }
 
-// called at the start of each FS system call.
+// called at the start of each FS system call, which
+// will write at most nblocks blocks.
 void
-begin_op(void)
+begin_op(int nblocks)
 {
+  struct proc *p = myproc();
+  int n, res;
+
+  n = nblocks + log.freeres;
+  if (n > NLOGREC || n*BSIZE > log.cap)
+    panic("begin_op: too many blocks");
+
+  if (p->txn) {
+    if (p->txnparked)
+      txn_unpark();
+    if (n > p->txnleft) {
+      // The group has used up its reservation. Commit what
+      // it has done and carry on in a new one. end_op() may
+      // begin another operation and so change p->logres.
+      res = p->logres;
+      p->txn = 0;
+      end_op();
+      begin_op(res - log.freeres);
+      p->txn = 1;
+      p->txnleft = res;
+      p->txnbroken = 1;
+    }
+    p->txnleft -= n;
+    return;
+  }
+
   acquire(&log.lock);
   while(1){
-    if(log.committing){
+    if(log.freezing){
       sleep(&log, &log.lock);
-    } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
+    } else if(log.lh.n + log.reserved + n > NLOGREC ||
+              log.nbytes + (log.reserved + n)*BSIZE > log.cap){
       // this op might exhaust log space; wait for commit.
+      // With asynchronous commit nobody may be about to,
+      // so ask for one, or commit if no op is outstanding.
+      if(log.outstanding == log.parked && !log.committing){
+        commit_running();
+        acquire(&log.lock);
+        continue;
+      }
+      log.commitwant = 1;
       sleep(&log, &log.lock);
     } else {
       log.outstanding += 1;
+      log.reserved += n;
+      myproc()->logres = n;
       release(&log.lock);
       break;
     }
   }
 }
 
-// called at the end of each FS system call.
-// commits if this was the last outstanding operation.
-void
-end_op(void)
+static int
+iszero(uchar *p)
 {
-  int do_commit = 0;
+  int i;
 
+  for (i = 0; i < BSIZE; i++)
+    if (p[i])
+      return 0;
+  return 1;
+}
+
+// Append a record for each range of the running transaction
+// after those already in the log, copying its bytes from the
+// cache into the staging buffers, and start a new, empty running
+// transaction. The caller has set log.freezing, so nobody is
+// modifying these blocks. Returns the new record count and sets
+// *nbytes to the new amount of range data; clh.n and cbytes are
+// only advanced once the data is on disk.
+static int
+freeze(int *nbytes)
+{
+  struct logrec *r;
+  int tail, n, pos;
+
+  n = clh.n;
+  pos = cbytes;
+  for (tail = 0; tail < log.lh.n; tail++, n++) {
+    r = &log.lh.rec[tail];
+    struct buf *from = bread(log.dev, r->blockno); // cache block
+    clh.rec[n] = *r;
+    if (r->len == BSIZE && iszero(from->data)) {
+      clh.rec[n].len = 0;
+    } else {
+      logcopy(pos, from->data + r->off, r->len, 1);
+      pos += r->len;
+    }
+    brelse(from);
+  }
+  log.lh.n = 0;
+  log.nbytes = 0;
+  log.nrec = n;
+  memmove(cfreed, log.freed, sizeof(cfreed));
+  ncfreed = log.nfreed;
+  log.nfreed = 0;
+  *nbytes = pos;
+  return n;
+}
+
+// Install everything in the log and empty it.
+// Caller holds log.committing.
+static void
+checkpoint(void)
+{
+  if (clh.n > 0) {
+    install_trans(1); // Copy to home locations, unpin
+    clh.n = 0;
+    cbytes = 0;
+    log.nrec = 0;
+    write_head();    // Erase the installed transactions from the log
+  }
+}
+
+// End the current operation; commit if this was the last
+// outstanding one, unless commits are asynchronous: then only if
+// someone asked for a commit or a full-sized op would not fit.
+static void
+finish_op(void)
+{
   acquire(&log.lock);
   log.outstanding -= 1;
-  if(log.committing)
-    panic("log.committing");
-  if(log.outstanding == 0){
-    do_commit = 1;
-    log.committing = 1;
-  } else {
+  log.reserved -= myproc()->logres;
+
+  if(COMMITTICKS > 0 && !log.commitwant &&
+     log.lh.n + MAXOPBLOCKS + log.freeres <= NLOGREC &&
+     log.nbytes + (MAXOPBLOCKS + log.freeres)*BSIZE <= log.cap){
+    // the flusher will commit.
+    wakeup(&log);
+    release(&log.lock);
+    return;
+  }
+
+  // The last operation out commits, once any earlier
+  // transaction has finished writing. While it waits,
+  // new operations may join the running transaction;
+  // then the last of those commits instead. Parked
+  // groups do not count: they are split.
+  while(log.outstanding == log.parked && log.lh.n > 0 && log.committing)
+    sleep(&log, &log.lock);
+  if(log.outstanding > log.parked || log.lh.n == 0){
     // begin_op() may be waiting for log space,
     // and decrementing log.outstanding has decreased
     // the amount of reserved space.
     wakeup(&log);
+    release(&log.lock);
+    return;
   }
-  release(&log.lock);
+  commit_running();
+}
 
-  if(do_commit){
-    // call commit w/o holding locks, since not allowed
-    // to sleep with locks.
-    commit();
-    acquire(&log.lock);
-    log.committing = 0;
-    wakeup(&log);
-    release(&log.lock);
+// called at the end of each FS system call.
+void
+end_op(void)
+{
+  if (myproc()->txn) {
+    txn_park();      // the group's txn_end() will end it
+    return;
   }
+
+  iupdatedone();     // write back the inodes this op changed
+  finish_op();
+  dirmaintain();     // then rehash or split a directory it filled
 }
 
-// Copy modified blocks from cache to log.
+// Commit the running transaction. Caller holds log.lock, no
+// operation is outstanding except parked groups, and no commit
+// is in progress. Returns with log.lock released.
 static void
-write_log(void)
+commit_running(void)
 {
-  int tail;
+  int n, nbytes, id;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start+tail+1); // log block
-    struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
-    memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
-    brelse(from);
-    brelse(to);
-  }
+  // Hold off new operations, and parked groups, until the
+  // transaction is frozen, so none of them is half in it.
+  log.committing = 1;
+  log.freezing = 1;
+  release(&log.lock);
+
+  // call checkpoint, freeze and commit w/o holding locks,
+  // since not allowed to sleep with locks.
+  if (clh.n + log.lh.n > NLOGREC || cbytes + log.nbytes > log.cap)
+    checkpoint();    // no room after the uninstalled transactions
+  n = freeze(&nbytes);
+  acquire(&log.lock);
+  log.freezing = 0;
+  log.commitwant = 0;
+  id = log.seq++;
+  wakeup(&log);
+  release(&log.lock);
+
+  commit(n, nbytes);
+  acquire(&log.lock);
+  log.committing = 0;
+  log.done = id;
+  ncfreed = 0;       // those frees are on disk now
+  if (cbytes >= log.cap/2 || clh.n >= NLOGREC/2)
+    log.kick = 1;    // worth installing a batch now
+  wakeup(&log);
+  release(&log.lock);
 }
 
+// Start a group of FS system calls that commit together.
+int
+txn_begin(void)
+{
+  struct proc *p = myproc();
+  int n;
+
+  if (p->txn)
+    return -1;
+  n = TXNBLOCKS;
+  if ((n + log.freeres) * BSIZE > log.cap)
+    n = log.cap/BSIZE - log.freeres;  // a small log; at least MAXOPBLOCKS
+  begin_op(n);
+  p->txn = 1;
+  p->txnleft = p->logres;
+  p->txnbroken = 0;
+  txn_park();
+  return 0;
+}
+
+// End the group. Returns -1 if it had to be committed in
+// parts, so it was not atomic, or if there was none.
+int
+txn_end(void)
+{
+  struct proc *p = myproc();
+
+  if (!p->txn)
+    return -1;
+  if (p->txnparked)
+    txn_unpark();
+  p->txn = 0;
+  end_op();
+  return p->txnbroken ? -1 : 0;
+}
+
+// The group's process is leaving the file system. Write back
+// the inodes it changed, so that a commit while it is away
+// takes whole operations, and let commits go ahead without it.
+static void
+txn_park(void)
+{
+  struct proc *p = myproc();
+
+  iupdatedone();
+  acquire(&log.lock);
+  log.parked += 1;
+  p->txnparked = 1;
+  p->txnseq = log.seq;
+  wakeup(&log);      // begin_op() or log_sync() may be waiting
+  release(&log.lock);
+}
+
+// The group's process is back for another FS call. If its
+// transaction was committed meanwhile, it was split.
 static void
-commit()
+txn_unpark(void)
 {
-  if (log.lh.n > 0) {
-    write_log();     // Write modified blocks from cache to log
+  struct proc *p = myproc();
+
+  acquire(&log.lock);
+  while (log.freezing)
+    sleep(&log, &log.lock);
+  log.parked -= 1;
+  p->txnparked = 0;
+  if (log.seq != p->txnseq)
+    p->txnbroken = 1;
+  release(&log.lock);
+}
+
+// Write the log blocks holding range data from cbytes up to
+// nbytes. The first may be partly filled by an earlier commit;
+// rewriting it leaves those bytes unchanged.
+static int
+write_log(int nbytes)
+{
+  int i;
+
+  for (i = cbytes/BSIZE; i*BSIZE < nbytes; i++)
+    logio(&logbuf[i], log.start+i+1, 1);  // write the log
+  return i - cbytes/BSIZE;
+}
+
+static void
+commit(int n, int nbytes)
+{
+  int i;
+
+  if (n > clh.n) {
+    fsstats.logwrites += write_log(nbytes) + 1;  // Write ranges to log
+    fsstats.commits++;
+    for (i = clh.n; i < n; i++)
+      if (clh.rec[i].len == 0)
+        fsstats.zerorecs++;
+    clh.n = n;
+    cbytes = nbytes;
     write_head();    // Write header to disk -- the real commit
-    install_trans(); // Now install writes to home locations
-    log.lh.n = 0;
-    write_head();    // Erase the transaction from the log
   }
 }
 
-// Caller has modified b->data and is done with the buffer.
-// Record the block number and pin in the cache with B_DIRTY.
+// Wait until every FS system call that finished before this
+// one is committed, committing the running transaction if
+// need be. Fails inside a group, which could never commit.
+int
+log_sync(void)
+{
+  int target;
+
+  if (myproc()->txn)
+    return -1;
+
+  acquire(&log.lock);
+  target = log.lh.n > 0 ? log.seq : log.seq - 1;
+  while (log.done < target) {
+    if (log.seq == target && log.outstanding == log.parked && !log.committing) {
+      commit_running();
+      acquire(&log.lock);
+    } else {
+      log.commitwant = 1;
+      sleep(&log, &log.lock);
+    }
+  }
+  release(&log.lock);
+  return 0;
+}
+
+// Kernel thread that commits the running transaction every
+// COMMITTICKS ticks when commits are asynchronous, and
+// installs committed transactions in the background.
+static void
+flusher(void)
+{
+  uint now, lastcommit, lastckpt;
+
+  lastcommit = lastckpt = 0;
+  for (;;) {
+    acquire(&tickslock);
+    sleep(&ticks, &tickslock);
+    now = ticks;
+    release(&tickslock);
+
+    acquire(&log.lock);
+    if (COMMITTICKS > 0 && log.lh.n > 0 &&
+        (log.commitwant || now - lastcommit >= COMMITTICKS)) {
+      lastcommit = now;
+      if (log.outstanding == log.parked && !log.committing) {
+        commit_running();
+        acquire(&log.lock);
+      } else {
+        log.commitwant = 1;  // the last op out will commit
+      }
+    }
+    if (log.parked > 0 && log.outstanding == log.parked &&
+        log.lh.n > 0 && !log.committing && now - log.opened >= TXNTICKS) {
+      // Only parked groups hold this transaction open: commit
+      // without them rather than wait for their processes.
+      commit_running();
+      acquire(&log.lock);
+    }
+    if (!log.kick && now - lastckpt < CKPTTICKS) {
+      release(&log.lock);
+      continue;
+    }
+    lastckpt = now;
+    log.kick = 0;
+    while (log.committing)
+      sleep(&log, &log.lock);
+    log.committing = 1;
+    release(&log.lock);
+
+    checkpoint();
+
+    acquire(&log.lock);
+    log.committing = 0;
+    wakeup(&log);
+    release(&log.lock);
+  }
+}
+
+// Caller has modified len bytes of b->data at off and is done
+// with the buffer. Widen the block's range in the running
+// transaction to cover them, and pin the block in the cache.
 // commit()/write_log() will do the disk write.
 //
-// log_write() replaces bwrite(); a typical use is:
+// log_write_range() replaces bwrite(); a typical use is:
 //   bp = bread(...)
-//   modify bp->data[]
-//   log_write(bp)
+//   modify bp->data[off..off+len)
+//   log_write_range(bp, off, len)
 //   brelse(bp)
 void
-log_write(struct buf *b)
+log_write_range(struct buf *b, uint off, uint len)
 {
+  struct logrec *r;
+  uint lo, hi;
   int i;
 
-  if (log.lh.n >= LOGSIZE || log.lh.n >= log.size - 1)
-    panic("too big a transaction");
+  if (off + len > BSIZE || len == 0)
+    panic("log_write_range");
   if (log.outstanding < 1)
     panic("log_write outside of trans");
 
   acquire(&log.lock);
   for (i = 0; i < log.lh.n; i++) {
-    if (log.lh.block[i] == b->blockno)   // log absorbtion
+    if (log.lh.rec[i].blockno == b->blockno)   // log absorbtion
       break;
   }
-  log.lh.block[i] = b->blockno;
-  if (i == log.lh.n)
-    log.lh.n++;
-  b->flags |= B_DIRTY; // prevent eviction
+  r = &log.lh.rec[i];
+  if (i == log.lh.n) {  // add new block to log
+    if (log.lh.n >= NLOGREC)
+      panic("too big a transaction");
+    r->blockno = b->blockno;
+    r->off = off;
+    r->len = 0;
+    bpin(b);
+    if (log.lh.n++ == 0)
+      log.opened = ticks;
+  }
+  lo = r->off < off ? r->off : off;
+  hi = r->off + r->len > off + len ? r->off + r->len : off + len;
+  log.nbytes += (hi - lo) - r->len;
+  r->off = lo;
+  r->len = hi - lo;
+  if (log.nbytes > log.cap)
+    panic("too big a transaction");
   release(&log.lock);
 }
 
+// Note that block b was freed by the running transaction.
+// Until that commits it must not be written around the log.
+void
+log_freed(uint b)
+{
+  acquire(&log.lock);
+  if (log.nfreed < NFREED)
+    log.freed[log.nfreed++] = b;
+  else
+    log.nfreed = NFREED + 1;
+  release(&log.lock);
+}
+
+static int
+listed(uint *list, int n, uint b)
+{
+  int i;
+
+  if (n > NFREED)
+    return 1;
+  for (i = 0; i < n; i++)
+    if (list[i] == b)
+      return 1;
+  return 0;
+}
+
+// Must block b be written through the log? It must if the log
+// holds it, since installing would overwrite a direct write,
+// or if an uncommitted transaction freed it, since a crash
+// would give it back to its old owner. Caller is in a
+// transaction, so no commit can start meanwhile.
+int
+log_holds(uint b)
+{
+  int i, held;
+
+  acquire(&log.lock);
+  held = listed(log.freed, log.nfreed, b) || listed(cfreed, ncfreed, b);
+  for (i = 0; !held && i < log.lh.n; i++)
+    held = log.lh.rec[i].blockno == b;
+  for (i = 0; !held && i < log.nrec; i++)
+    held = clh.rec[i].blockno == b;
+  release(&log.lock);
+  return held;
+}
+
+// Log the whole of b.
+void
+log_write(struct buf *b)
+{
+  log_write_range(b, 0, BSIZE);
+}
@@ -64,8 +64,8 @@ void
 ls(char *path)
 {
   char buf[512], *p;
-  int fd;
-  struct dirent de;
+  int fd, n, i;
+  struct direntplus de[16];
   struct stat st;
 
   if((fd = open(path, 0)) < 0){
@@ -96,22 +96,20 @@ ls(char *path)
     strcpy(buf, path);
     p = buf+strlen(buf);
     *p++ = '/';
-    while(read(fd, &de, sizeof(de)) == sizeof(de)){
-      if(de.inum == 0)
-        continue;
-      memmove(p, de.name, DIRSIZ);
-      p[DIRSIZ] = 0;
-      if(stat(buf, &st) < 0){
-        printf(1, "ls: cannot stat %s\n", buf);
-        continue;
+    while((n = getdents_plus(fd, de, sizeof(de)/sizeof(de[0]))) > 0){
+      for(i = 0; i < n; i++){
+        memmove(p, de[i].name, DIRSIZ);
+        p[DIRSIZ] = 0;
+        printf(1, "%s%s  %s  %s %d %d %d\n",
+          (de[i].type == T_DIR ? "d" : "-"),
+          fmtpermission(de[i].perm),
+          fmtusername(de[i].owner_name, de[i].owner),
+          fmtname(buf),
+          de[i].type, de[i].ino, de[i].size);
       }
-      printf(1, "%s%s  %s  %s %d %d %d\n",
-        (st.type == T_DIR ? "d" : "-"),
-        fmtpermission(st.perm),
-        fmtusername(st.owner_name, st.owner),
-        fmtname(buf),
-        st.type, st.ino, st.size);
     }
+    if(n < 0)
+      printf(1, "ls: cannot list %s\n", path);
     break;
   }
   close(fd);
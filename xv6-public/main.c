@@ -30,7 +30,9 @@ main(void)
   tvinit();        // trap vectors
   binit();         // buffer cache
   fileinit();      // file table
+  pciinit();       // pci devices
   ideinit();       // disk 
+  virtioinit();    // virtio-blk disk, if present
   startothers();   // start other processors
   kinit2(P2V(4*1024*1024), P2V(PHYSTOP)); // must come after startothers()
   userinit();      // first user process
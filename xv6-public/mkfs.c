@@ -20,15 +20,16 @@
 // Disk layout:
 // [ boot block | sb block | log | inode blocks | free bit map | data blocks ]
 
-int nbitmap = FSSIZE/(BSIZE*8) + 1;
-int ninodeblocks = NINODES / IPB + 1;
-int nlog = LOGSIZE;
+int fssize = FSSIZE;     // blocks in the image; -s sets it
+int ninodes = NINODES;   // -i sets it
+int nbitmap;
+int ninodeblocks;
+int nlog = LOGSIZE + 1;  // header and data blocks; -l sets the latter
 int nmeta;    // Number of meta blocks (boot, sb, nlog, inode, bitmap)
 int nblocks;  // Number of data blocks
 
 int fsfd;
 struct superblock sb;
-char zeroes[BSIZE];
 uint freeinode = 1;
 uint freeblock;
 
@@ -40,6 +41,7 @@ void rinode(uint inum, struct dinode *ip);
 void rsect(uint sec, void *buf);
 uint ialloc(ushort type);
 void iappend(uint inum, void *p, int n);
+void iinline(uint inum, void *p, int n);
 
 // convert to intel byte order
 ushort
@@ -76,8 +78,44 @@ main(int argc, char *argv[])
 
   static_assert(sizeof(int) == 4, "Integers must be 4 bytes!");
 
-  if(argc < 2){
-    fprintf(stderr, "Usage: mkfs fs.img files...\n");
+  while(argc > 2 && argv[1][0] == '-'){
+    if(strcmp(argv[1], "-l") == 0)
+      nlog = atoi(argv[2]) + 1;
+    else if(strcmp(argv[1], "-s") == 0)
+      fssize = atoi(argv[2]);
+    else if(strcmp(argv[1], "-i") == 0)
+      ninodes = atoi(argv[2]);
+    else
+      break;
+    argc -= 2;
+    argv += 2;
+  }
+
+  if(argc < 2 || argv[1][0] == '-'){
+    fprintf(stderr, "Usage: mkfs [-l logblocks] [-s blocks] [-i inodes] "
+            "fs.img files...\n");
+    exit(1);
+  }
+
+  // The kernel summarizes at most NBMAP bitmap blocks and NIBLOCK
+  // inode blocks, and ide.c addresses sectors with LBA28.
+  nbitmap = fssize/BPB + 1;
+  ninodeblocks = ninodes/IPB + 1;
+  if(fssize < 100 || nbitmap > NBMAP ||
+     (unsigned long long)fssize * (BSIZE/512) > (1 << 28)){
+    fprintf(stderr, "mkfs: bad size %d blocks\n", fssize);
+    exit(1);
+  }
+  if(ninodes < 2 || ninodes > 65535 || ninodeblocks > NIBLOCK){
+    fprintf(stderr, "mkfs: bad inode count %d\n", ninodes);
+    exit(1);
+  }
+  // Freeing a file may touch every bitmap block (see initlog()).
+  if(nlog - 1 < MAXOPBLOCKS + nbitmap + 1 || nlog - 1 > LOGSIZE){
+    fprintf(stderr, "mkfs: log must have %d to %d blocks\n",
+            MAXOPBLOCKS + nbitmap + 1, LOGSIZE);
+    if(MAXOPBLOCKS + nbitmap + 1 > LOGSIZE)
+      fprintf(stderr, "mkfs: too big for the log; use bigger blocks\n");
     exit(1);
   }
 
@@ -92,23 +130,28 @@ main(int argc, char *argv[])
 
   // 1 fs block = 1 disk sector
   nmeta = 2 + nlog + ninodeblocks + nbitmap;
-  nblocks = FSSIZE - nmeta;
+  nblocks = fssize - nmeta;
 
-  sb.size = xint(FSSIZE);
+  sb.size = xint(fssize);
   sb.nblocks = xint(nblocks);
-  sb.ninodes = xint(NINODES);
+  sb.ninodes = xint(ninodes);
   sb.nlog = xint(nlog);
   sb.logstart = xint(2);
   sb.inodestart = xint(2+nlog);
   sb.bmapstart = xint(2+nlog+ninodeblocks);
+  sb.bsize = xint(BSIZE);
 
   printf("nmeta %d (boot, super, log blocks %u inode blocks %u, bitmap blocks %u) blocks %d total %d\n",
-         nmeta, nlog, ninodeblocks, nbitmap, nblocks, FSSIZE);
+         nmeta, nlog, ninodeblocks, nbitmap, nblocks, fssize);
 
   freeblock = nmeta;     // the first free block that we can allocate
 
-  for(i = 0; i < FSSIZE; i++)
-    wsect(i, zeroes);
+  // A fresh file reads as zeroes; only blocks mkfs writes take
+  // space, so even a big image is quick to make.
+  if(ftruncate(fsfd, (off_t)fssize * BSIZE) < 0){
+    perror("ftruncate");
+    exit(1);
+  }
 
   memset(buf, 0, sizeof(buf));
   memmove(buf, &sb, sizeof(sb));
@@ -149,8 +192,15 @@ main(int argc, char *argv[])
     strncpy(de.name, argv[i], DIRSIZ);
     iappend(rootino, &de, sizeof(de));
 
-    while((cc = read(fd, buf, sizeof(buf))) > 0)
-      iappend(inum, buf, cc);
+    // Files of up to NINLINE bytes go in the inode itself.
+    cc = lseek(fd, 0, SEEK_END);
+    lseek(fd, 0, SEEK_SET);
+    if(cc <= NINLINE)
+      iinline(inum, buf, read(fd, buf, sizeof(buf)));
+    else {
+      while((cc = read(fd, buf, sizeof(buf))) > 0)
+        iappend(inum, buf, cc);
+    }
 
     close(fd);
   }
@@ -170,7 +220,7 @@ main(int argc, char *argv[])
 void
 wsect(uint sec, void *buf)
 {
-  if(lseek(fsfd, sec * BSIZE, 0) != sec * BSIZE){
+  if(lseek(fsfd, (off_t)sec * BSIZE, 0) != (off_t)sec * BSIZE){
     perror("lseek");
     exit(1);
   }
@@ -210,7 +260,7 @@ rinode(uint inum, struct dinode *ip)
 void
 rsect(uint sec, void *buf)
 {
-  if(lseek(fsfd, sec * BSIZE, 0) != sec * BSIZE){
+  if(lseek(fsfd, (off_t)sec * BSIZE, 0) != (off_t)sec * BSIZE){
     perror("lseek");
     exit(1);
   }
@@ -226,6 +276,8 @@ ialloc(ushort type)
   uint inum = freeinode++;
   struct dinode din;
 
+  assert(inum < ninodes);
+
   bzero(&din, sizeof(din));
   din.type = xshort(type);
   din.nlink = xshort(1);
@@ -254,6 +306,21 @@ balloc(int used)
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 
+// Return entry i of indirect block ind, allocating a block
+// for it if it has none.
+uint
+indirect_entry(uint ind, uint i)
+{
+  uint indirect[NINDIRECT];
+
+  rsect(ind, (char*)indirect);
+  if(indirect[i] == 0){
+    indirect[i] = xint(freeblock++);
+    wsect(ind, (char*)indirect);
+  }
+  return xint(indirect[i]);
+}
+
 void
 iappend(uint inum, void *xp, int n)
 {
@@ -261,7 +328,6 @@ iappend(uint inum, void *xp, int n)
   uint fbn, off, n1;
   struct dinode din;
   char buf[BSIZE];
-  uint indirect[NINDIRECT];
   uint x;
 
   rinode(inum, &din);
@@ -275,16 +341,19 @@ iappend(uint inum, void *xp, int n)
         din.addrs[fbn] = xint(freeblock++);
       }
       x = xint(din.addrs[fbn]);
-    } else {
+    } else if(fbn < NDIRECT + NINDIRECT){
       if(xint(din.addrs[NDIRECT]) == 0){
         din.addrs[NDIRECT] = xint(freeblock++);
       }
-      rsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      if(indirect[fbn - NDIRECT] == 0){
-        indirect[fbn - NDIRECT] = xint(freeblock++);
-        wsect(xint(din.addrs[NDIRECT]), (char*)indirect);
+      x = indirect_entry(xint(din.addrs[NDIRECT]), fbn - NDIRECT);
+    } else {
+      if(xint(din.addrs[NDIRECT+1]) == 0){
+        din.addrs[NDIRECT+1] = xint(freeblock++);
       }
-      x = xint(indirect[fbn-NDIRECT]);
+      fbn -= NDIRECT + NINDIRECT;
+      x = indirect_entry(xint(din.addrs[NDIRECT+1]), fbn / NINDIRECT);
+      x = indirect_entry(x, fbn % NINDIRECT);
+      fbn += NDIRECT + NINDIRECT;
     }
     n1 = min(n, (fbn + 1) * BSIZE - off);
     rsect(x, buf);
@@ -297,3 +366,17 @@ iappend(uint inum, void *xp, int n)
   din.size = xint(off);
   winode(inum, &din);
 }
+
+// Store the n bytes at xp as the data of the empty inode inum.
+void
+iinline(uint inum, void *xp, int n)
+{
+  struct dinode din;
+
+  assert(n <= NINLINE);
+  rinode(inum, &din);
+  din.minor = xshort(IF_INLINE);
+  bcopy(xp, din.addrs, n);
+  din.size = xint(n);
+  winode(inum, &din);
+}
@@ -2,15 +2,47 @@
 #define KSTACKSIZE 4096  // size of per-process kernel stack
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
+#define NSHLOCK       4  // sleep-locks a process may hold shared
 #define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
+#define NINODE       50  // i-nodes cached before the cache grows
+#define NINODEMAX  1000  // maximum number of cached i-nodes
+#define NDCACHE     256  // cached directory names; a multiple of 4
+#define NDIRLIST     32  // max entries per getdents_plus() call
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
-#define MAXOPBLOCKS  10  // max # of blocks any FS op writes
-#define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
-#define FSSIZE       1000  // size of file system in blocks
+#define MAXOPBLOCKS  10  // max # of blocks an FS op writes, unless declared
+#define CREATEBLOCKS  8  // max # of blocks create() writes
+#define DIRBLOCKS    24  // max # of blocks hashing or splitting a directory writes
+#define STREAMBLOCKS 64  // max data blocks per large-write transaction
+#define STREAMLOGGED  4  // of which may need logging
+#define TXNBLOCKS    30  // max # of blocks a user transaction writes
+#define TXNTICKS    100  // longest a user transaction holds up commits
+#define NDIRTYI       8  // max inodes an FS op writes back when it ends
+#define INDBLOCKS     3  // indirect blocks a write of < 128 blocks may change
+#ifndef COMMITTICKS
+#define COMMITTICKS   0  // if > 0, commit asynchronously this often
+#endif
+#define LOGSIZE      64  // max data blocks in on-disk log
+#define NLOGREC      60  // max blocks recorded in the log header
+#ifndef DELAYBLOCKS
+#define DELAYBLOCKS   8  // file blocks whose allocation may wait; 0 for none
+#endif
+#define NDELAY       32  // max buffers holding not yet allocated blocks
+#ifndef EXTENTS
+#define EXTENTS       1  // if 1, new regular files map blocks with extents
+#endif
+#ifndef DIRHASH
+#define DIRHASH    2048  // hash directories past this many bytes; 0 for never
+#endif
+#ifndef INLINEDATA
+#define INLINEDATA    1  // if 1, new regular files keep tiny contents in the inode
+#endif
+#define NBUF         (NLOGREC*2+MAXOPBLOCKS*3+NDELAY)  // size of disk block cache
+#define FSSIZE       (20000*512/BSIZE)  // default size of fs.img in blocks (10MB)
+#define NBMAP        1024  // max free-map blocks the allocator summarizes
+#define NIBLOCK      1024  // max inode blocks ialloc() summarizes
+#define NDISKREQ     32  // max outstanding virtio-blk requests
 
 #define USERNAME_MAXLEN 16
 #define USER_PW_MAXLEN 16
@@ -0,0 +1,91 @@
+// Path lookup benchmark: 1 to nproc processes each open and
+// close a file DEPTH directories deep, over and over, and the
+// total rate is reported for each number of processes, with how
+// many lookups took the lock-free path.
+//
+//   pathbench [nproc [nopens]]
+//
+// Run under "make qemu CPUS=4".
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+#include "fsstats.h"
+
+#define DEPTH  8
+
+char path[2*DEPTH + 8];
+
+void
+opener(int n)
+{
+  int i, fd;
+
+  for(i = 0; i < n; i++){
+    if((fd = open(path, O_RDONLY)) < 0){
+      printf(1, "pathbench: open %s failed\n", path);
+      exit();
+    }
+    close(fd);
+  }
+  exit();
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct fsstats st0, st;
+  int nproc, nopen, n, i, fd, start, t;
+  char *p;
+
+  nproc = argc > 1 ? atoi(argv[1]) : 4;
+  nopen = argc > 2 ? atoi(argv[2]) : 2000;
+
+  // pa/b/c/.../file
+  p = path;
+  for(i = 0; i < DEPTH; i++){
+    if(i == 0)
+      *p++ = 'p';
+    *p++ = 'a' + i;
+    *p = 0;
+    if(mkdir(path) < 0){
+      printf(1, "pathbench: mkdir %s failed\n", path);
+      exit();
+    }
+    *p++ = '/';
+  }
+  strcpy(p, "file");
+  if((fd = open(path, O_CREATE | O_RDWR)) < 0){
+    printf(1, "pathbench: create %s failed\n", path);
+    exit();
+  }
+  close(fd);
+
+  for(n = 1; n <= nproc; n++){
+    fsstats(&st0);
+    start = uptime();
+    for(i = 0; i < n; i++){
+      if(fork() == 0)
+        opener(nopen);
+    }
+    for(i = 0; i < n; i++)
+      wait();
+    t = uptime() - start;
+    fsstats(&st);
+    printf(1, "pathbench: %d procs, %d opens in %d ticks", n, n * nopen, t);
+    if(t > 0)
+      printf(1, ", %d opens/100 ticks", n * nopen * 100 / t);
+    printf(1, "; %d fast, %d slow lookups\n",
+           st.fastlookups - st0.fastlookups, st.slowlookups - st0.slowlookups);
+  }
+
+  // Remove the file, then the directories, deepest first.
+  unlink(path);
+  for(i = DEPTH - 1; i >= 0; i--){
+    *p = 0;
+    p -= 2;
+    unlink(path);
+  }
+  exit();
+}
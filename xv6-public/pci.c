@@ -0,0 +1,120 @@
+// PCI bus enumeration using configuration mechanism #1.
+// The BIOS has already assigned BARs and interrupt lines,
+// so all we do here is record what is present.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "x86.h"
+#include "pci.h"
+
+#define PCI_CONFADDR  0xcf8
+#define PCI_CONFDATA  0xcfc
+
+#define NPCIDEV  32   // maximum number of functions remembered
+
+static struct pcidev pcidevs[NPCIDEV];
+static int npcidev;
+
+static uint
+confaddr(int bus, int dev, int func, int off)
+{
+  return 0x80000000 | (bus << 16) | (dev << 11) | (func << 8) | (off & 0xfc);
+}
+
+uint
+pciconfread(struct pcidev *d, int off)
+{
+  outl(PCI_CONFADDR, confaddr(d->bus, d->dev, d->func, off));
+  return inl(PCI_CONFDATA);
+}
+
+void
+pciconfwrite(struct pcidev *d, int off, uint v)
+{
+  outl(PCI_CONFADDR, confaddr(d->bus, d->dev, d->func, off));
+  outl(PCI_CONFDATA, v);
+}
+
+// Turn on I/O decoding and bus mastering for d.
+void
+pcienable(struct pcidev *d)
+{
+  uint cmd;
+
+  cmd = pciconfread(d, PCI_COMMAND) & 0xffff;
+  cmd |= PCI_CMD_IO | PCI_CMD_MEM | PCI_CMD_MASTER;
+  pciconfwrite(d, PCI_COMMAND, cmd);
+}
+
+static void
+pciadd(int bus, int dev, int func, uint id)
+{
+  struct pcidev *d;
+  uint class;
+  int i;
+
+  if(npcidev >= NPCIDEV)
+    return;
+  d = &pcidevs[npcidev++];
+  d->bus = bus;
+  d->dev = dev;
+  d->func = func;
+  d->vendor = id & 0xffff;
+  d->device = id >> 16;
+  class = pciconfread(d, PCI_CLASS);
+  d->class = class >> 24;
+  d->subclass = class >> 16;
+  d->progif = class >> 8;
+  d->irq = pciconfread(d, PCI_INTERRUPT) & 0xff;
+  for(i = 0; i < 6; i++)
+    d->bar[i] = pciconfread(d, PCI_BAR0 + 4*i);
+}
+
+void
+pciinit(void)
+{
+  struct pcidev probe;
+  int dev, func, nfunc;
+  uint id;
+
+  // QEMU and Bochs put everything on bus 0.
+  probe.bus = 0;
+  for(dev = 0; dev < 32; dev++){
+    probe.dev = dev;
+    nfunc = 1;
+    for(func = 0; func < nfunc; func++){
+      probe.func = func;
+      id = pciconfread(&probe, PCI_VENDOR_ID);
+      if((id & 0xffff) == 0xffff)
+        continue;
+      if(func == 0 && (pciconfread(&probe, PCI_HEADER) & 0x800000))
+        nfunc = 8;  // multi-function device
+      pciadd(0, dev, func, id);
+    }
+  }
+}
+
+// Return the first function with the given class and subclass.
+struct pcidev*
+pcifindclass(int class, int subclass)
+{
+  struct pcidev *d;
+
+  for(d = pcidevs; d < pcidevs+npcidev; d++)
+    if(d->class == class && d->subclass == subclass)
+      return d;
+  return 0;
+}
+
+// Return the first function with the given vendor and device id.
+struct pcidev*
+pcifind(int vendor, int device)
+{
+  struct pcidev *d;
+
+  for(d = pcidevs; d < pcidevs+npcidev; d++)
+    if(d->vendor == vendor && d->device == device)
+      return d;
+  return 0;
+}
@@ -0,0 +1,29 @@
+// PCI configuration space.
+
+#define PCI_VENDOR_ID   0x00  // vendor (low 16) and device (high 16) id
+#define PCI_COMMAND     0x04  // command (low 16) and status (high 16)
+#define PCI_CLASS       0x08  // revision, prog-if, subclass, class
+#define PCI_HEADER      0x0c  // cache line, latency, header type, BIST
+#define PCI_BAR0        0x10  // first of six base address registers
+#define PCI_INTERRUPT   0x3c  // interrupt line (low 8) and pin
+
+#define PCI_CMD_IO      0x01  // respond to I/O space accesses
+#define PCI_CMD_MEM     0x02  // respond to memory space accesses
+#define PCI_CMD_MASTER  0x04  // device may act as a bus master
+
+// A function found by pciinit().
+struct pcidev {
+  uchar bus;
+  uchar dev;
+  uchar func;
+  ushort vendor;
+  ushort device;
+  uchar class;
+  uchar subclass;
+  uchar progif;
+  uchar irq;          // interrupt line assigned by the BIOS
+  uint bar[6];        // base address registers, as read
+};
+
+// An I/O space BAR holds a port number in its upper bits.
+#define PCI_BAR_IO(bar)  ((ushort)((bar) & ~3))
@@ -88,6 +88,10 @@ allocproc(void)
 found:
   p->state = EMBRYO;
   p->pid = nextpid++;
+  p->txn = 0;
+  p->ndirtyi = 0;
+  p->dirwork = 0;
+  p->nshlock = 0;
 
   release(&ptable.lock);
 
@@ -154,6 +158,29 @@ userinit(void)
   release(&ptable.lock);
 }
 
+// Start a kernel thread that runs fn(), which must never return.
+// It has no user memory and never returns to user space: forkret()
+// releases ptable.lock as usual and then "returns" into fn.
+void
+kthread(char *name, void (*fn)(void))
+{
+  struct proc *p;
+
+  if((p = allocproc()) == 0)
+    panic("kthread");
+  if((p->pgdir = setupkvm()) == 0)
+    panic("kthread: out of memory?");
+  *(uint*)((char*)p->context + sizeof(*p->context)) = (uint)fn;
+  p->sz = 0;
+  p->parent = initproc;
+  p->uid = ROOT_UID;
+  safestrcpy(p->name, name, sizeof(p->name));
+
+  acquire(&ptable.lock);
+  p->state = RUNNABLE;
+  release(&ptable.lock);
+}
+
 // Grow current process's memory by n bytes.
 // Return 0 on success, -1 on failure.
 int
@@ -242,6 +269,9 @@ exit(void)
   if(curproc == initproc)
     panic("init exiting");
 
+  if(curproc->txn)
+    txn_end();
+
   // Close all open files.
   for(fd = 0; fd < NOFILE; fd++){
     if(curproc->ofile[fd]){
@@ -250,7 +280,7 @@ exit(void)
     }
   }
 
-  begin_op();
+  begin_op(0);
   iput(curproc->cwd);
   end_op();
   curproc->cwd = 0;
@@ -415,6 +445,8 @@ forkret(void)
     first = 0;
     iinit(ROOTDEV);
     initlog(ROOTDEV);
+    bsuminit(ROOTDEV);
+    isuminit(ROOTDEV);
     init_usertable();
   }
 
@@ -50,6 +50,17 @@ struct proc {
   struct inode *cwd;           // Current directory
   char name[16];               // Process name (debugging)
   uint uid;                    // Process owner 
+  int logres;                  // Log blocks reserved by current FS op
+  int txn;                     // If non-zero, in a user transaction
+  int txnleft;                 // Log blocks left in it
+  int txnbroken;               // It had to be committed in parts
+  int txnparked;               // Group open, but not in an FS call
+  int txnseq;                  // log.seq when it was parked
+  struct inode *dirtyi[NDIRTYI]; // Inodes to write back at end_op()
+  int ndirtyi;
+  struct inode *dirwork;       // Directory to rehash or split at end_op()
+  struct sleeplock *shlock[NSHLOCK]; // Sleep-locks it holds shared
+  int nshlock;
 };
 
 // Process memory is laid out contiguously, low addresses first:
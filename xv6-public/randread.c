@@ -0,0 +1,98 @@
+// Random-read benchmark: several processes read random
+// one-block files at once, so a disk driver that can keep
+// more than one request in flight has something to overlap.
+//
+//   randread [nproc [nreads]]
+//
+// Compare "make qemu" (IDE) with "make qemu DISK=virtio".
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+
+#define NFILE  160   // one block each; with their inodes more than NBUF
+
+char buf[512];
+
+void
+fname(char *p, int i)
+{
+  p[0] = 'r';
+  p[1] = 'r';
+  p[2] = '0' + i/100;
+  p[3] = '0' + (i/10)%10;
+  p[4] = '0' + i%10;
+  p[5] = 0;
+}
+
+uint
+rnd(uint *s)
+{
+  *s = *s * 1664525 + 1013904223;
+  return *s >> 8;
+}
+
+void
+reader(int id, int n)
+{
+  char name[6];
+  uint seed;
+  int i, fd;
+
+  seed = id * 7919 + 1;
+  for(i = 0; i < n; i++){
+    fname(name, rnd(&seed) % NFILE);
+    if((fd = open(name, O_RDONLY)) < 0){
+      printf(1, "randread: open %s failed\n", name);
+      exit();
+    }
+    if(read(fd, buf, sizeof(buf)) != sizeof(buf)){
+      printf(1, "randread: read %s failed\n", name);
+      exit();
+    }
+    close(fd);
+  }
+  exit();
+}
+
+int
+main(int argc, char *argv[])
+{
+  char name[6];
+  int nproc, nread, i, fd, start, t;
+
+  nproc = argc > 1 ? atoi(argv[1]) : 8;
+  nread = argc > 2 ? atoi(argv[2]) : 200;
+
+  for(i = 0; i < NFILE; i++){
+    fname(name, i);
+    if((fd = open(name, O_CREATE | O_RDWR)) < 0){
+      printf(1, "randread: create %s failed\n", name);
+      exit();
+    }
+    memset(buf, i, sizeof(buf));
+    write(fd, buf, sizeof(buf));
+    close(fd);
+  }
+
+  start = uptime();
+  for(i = 0; i < nproc; i++){
+    if(fork() == 0)
+      reader(i, nread);
+  }
+  for(i = 0; i < nproc; i++)
+    wait();
+  t = uptime() - start;
+
+  printf(1, "randread: %d procs x %d reads in %d ticks", nproc, nread, t);
+  if(t > 0)
+    printf(1, ", %d reads/100 ticks", nproc * nread * 100 / t);
+  printf(1, "\n");
+
+  for(i = 0; i < NFILE; i++){
+    fname(name, i);
+    unlink(name);
+  }
+  exit();
+}
@@ -16,6 +16,8 @@ initsleeplock(struct sleeplock *lk, char *name)
   initlock(&lk->lk, "sleep lock");
   lk->name = name;
   lk->locked = 0;
+  lk->nshared = 0;
+  lk->nwaiting = 0;
   lk->pid = 0;
 }
 
@@ -23,21 +25,66 @@ void
 acquiresleep(struct sleeplock *lk)
 {
   acquire(&lk->lk);
-  while (lk->locked) {
+  lk->nwaiting++;
+  while (lk->locked || lk->nshared > 0) {
     sleep(lk, &lk->lk);
   }
+  lk->nwaiting--;
   lk->locked = 1;
   lk->pid = myproc()->pid;
   release(&lk->lk);
 }
 
+// Share lk with other readers.  New readers wait while a
+// process waits to hold it exclusively, so writers are not
+// starved.  The process remembers which locks it shares.
+void
+acquiresleepshared(struct sleeplock *lk)
+{
+  struct proc *p = myproc();
+
+  if (p->nshlock == NSHLOCK)
+    panic("acquiresleepshared");
+  acquire(&lk->lk);
+  while (lk->locked || lk->nwaiting > 0) {
+    sleep(lk, &lk->lk);
+  }
+  lk->nshared++;
+  p->shlock[p->nshlock++] = lk;
+  release(&lk->lk);
+}
+
+// Forget that this process shares lk. Returns 0 if it does not.
+static int
+unshare(struct sleeplock *lk)
+{
+  struct proc *p = myproc();
+  int i;
+
+  for (i = 0; i < p->nshlock; i++) {
+    if (p->shlock[i] == lk) {
+      p->shlock[i] = p->shlock[--p->nshlock];
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// Release lk, held exclusively or shared.
 void
 releasesleep(struct sleeplock *lk)
 {
   acquire(&lk->lk);
-  lk->locked = 0;
-  lk->pid = 0;
-  wakeup(lk);
+  if (lk->locked) {
+    lk->locked = 0;
+    lk->pid = 0;
+  } else if (lk->nshared > 0 && unshare(lk)) {
+    lk->nshared--;
+  } else {
+    panic("releasesleep");
+  }
+  if (lk->nshared == 0)
+    wakeup(lk);
   release(&lk->lk);
 }
 
@@ -52,5 +99,20 @@ holdingsleep(struct sleeplock *lk)
   return r;
 }
 
+// Does this process hold lk, exclusively or shared?
+int
+holdingsleepany(struct sleeplock *lk)
+{
+  struct proc *p = myproc();
+  int i, r;
+
+  acquire(&lk->lk);
+  r = lk->locked && (lk->pid == p->pid);
+  for (i = 0; !r && i < p->nshlock; i++)
+    r = p->shlock[i] == lk;
+  release(&lk->lk);
+  return r;
+}
+
 
 
@@ -1,10 +1,15 @@
 // Long-term locks for processes
+//
+// A sleeplock is held either by one process, exclusively,
+// or by any number of processes sharing it.
 struct sleeplock {
-  uint locked;       // Is the lock held?
+  uint locked;       // Is the lock held exclusively?
+  int nshared;       // Processes sharing it
+  int nwaiting;      // Processes waiting to hold it exclusively
   struct spinlock lk; // spinlock protecting this sleep lock
   
   // For debugging:
   char *name;        // Name of lock.
-  int pid;           // Process holding lock
+  int pid;           // Process holding lock exclusively
 };
 
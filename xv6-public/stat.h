@@ -12,3 +12,16 @@ struct stat {
   uint owner;  // Owner of file
   char owner_name[16];
 };
+
+// A directory entry with its inode's stat data,
+// as returned by getdents_plus().
+struct direntplus {
+  char name[14];  // DIRSIZ bytes, NUL-terminated only if shorter
+  char perm;
+  char type;
+  uint ino;
+  short nlink;
+  uint size;
+  uint owner;
+  char owner_name[16];
+};
@@ -108,6 +108,12 @@ extern int sys_login(void);
 extern int sys_addUser(void);
 extern int sys_deleteUser(void);
 extern int sys_chmod(void);
+extern int sys_fsstats(void);
+extern int sys_fs_txn_begin(void);
+extern int sys_fs_txn_end(void);
+extern int sys_sync(void);
+extern int sys_fsync(void);
+extern int sys_getdents_plus(void);
 
 static int (*syscalls[])(void) = {
 [SYS_fork]    sys_fork,
@@ -135,7 +141,13 @@ static int (*syscalls[])(void) = {
 [SYS_login]      sys_login,
 [SYS_addUser]    sys_addUser,
 [SYS_deleteUser] sys_deleteUser,
-[SYS_chmod]      sys_chmod
+[SYS_chmod]      sys_chmod,
+[SYS_fsstats]    sys_fsstats,
+[SYS_fs_txn_begin] sys_fs_txn_begin,
+[SYS_fs_txn_end] sys_fs_txn_end,
+[SYS_sync]       sys_sync,
+[SYS_fsync]      sys_fsync,
+[SYS_getdents_plus] sys_getdents_plus
 };
 
 void
@@ -24,4 +24,10 @@
 #define SYS_login      22
 #define SYS_addUser    23
 #define SYS_deleteUser 24
-#define SYS_chmod      25
\ No newline at end of file
+#define SYS_chmod      25
+#define SYS_fsstats    26
+#define SYS_fs_txn_begin 27
+#define SYS_fs_txn_end 28
+#define SYS_sync       29
+#define SYS_fsync      30
+#define SYS_getdents_plus 31
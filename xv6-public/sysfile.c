@@ -15,6 +15,7 @@
 #include "sleeplock.h"
 #include "file.h"
 #include "fcntl.h"
+#include "fsstats.h"
 
 // Fetch the nth word-sized system call argument as a file descriptor
 // and return both the descriptor and the corresponding struct file.
@@ -124,7 +125,7 @@ sys_link(void)
   if(argstr(0, &old) < 0 || argstr(1, &new) < 0)
     return -1;
 
-  begin_op();
+  begin_op(6);  // ip, dp, dp's new block, its bitmap and indirect, chain link
   if((ip = namei(old)) == 0){
     end_op();
     return -1;
@@ -171,10 +172,12 @@ isdirempty(struct inode *dp)
   int off;
   struct dirent de;
 
-  for(off=2*sizeof(de); off<dp->size; off+=sizeof(de)){
+  // A hashed directory may keep . and .. anywhere.
+  for(off=0; off<dp->size; off+=sizeof(de)){
     if(readi(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
       panic("isdirempty: readi");
-    if(de.inum != 0)
+    if(de.inum != 0 && namecmp(de.name, ".") != 0 &&
+       namecmp(de.name, "..") != 0)
       return 0;
   }
   return 1;
@@ -192,7 +195,7 @@ sys_unlink(void)
   if(argstr(0, &path) < 0)
     return -1;
 
-  begin_op();
+  begin_op(3);  // dp's block, dp, ip
   if((dp = nameiparent(path, name)) == 0){
     end_op();
     return -1;
@@ -222,6 +225,7 @@ sys_unlink(void)
   memset(&de, 0, sizeof(de));
   if(writei(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
     panic("unlink: writei");
+  dcupdate(dp, name, 0);
   if(ip->type == T_DIR){
     dp->nlink--;
     iupdate(dp);
@@ -250,7 +254,7 @@ int sys_chmod (void) {
     return -1;
   }
 
-  begin_op();
+  begin_op(1);
 
   struct inode* ip = namei(path);
   if (ip == 0) {
@@ -302,12 +306,16 @@ create(char *path, short type, short major, short minor)
     return 0;
   }
 
-  if((ip = ialloc(dp->dev, type)) == 0)
+  if((ip = ialloc(dp->dev, type, dp->inum)) == 0)
     panic("create: ialloc");
 
   ilock(ip);
   ip->major = major;
   ip->minor = minor;
+  if(type == T_FILE && EXTENTS)
+    ip->minor |= IF_EXTENTS;
+  if(type == T_FILE && INLINEDATA)
+    ip->minor |= IF_INLINE;
   ip->nlink = 1;
   iupdate(ip);
 
@@ -338,7 +346,7 @@ sys_open(void)
   if(argstr(0, &path) < 0 || argint(1, &omode) < 0)
     return -1;
 
-  begin_op();
+  begin_op(omode & O_CREATE ? CREATEBLOCKS : 0);
 
   if(omode & O_CREATE){
     ip = create(path, T_FILE, 0, 0);
@@ -402,7 +410,7 @@ sys_mkdir(void)
   char *path;
   struct inode *ip;
 
-  begin_op();
+  begin_op(CREATEBLOCKS);
   if(argstr(0, &path) < 0 || (ip = create(path, T_DIR, 0, 0)) == 0){
     end_op();
     return -1;
@@ -424,7 +432,7 @@ sys_mknod(void)
   char *path;
   int major, minor;
 
-  begin_op();
+  begin_op(CREATEBLOCKS);
   if((argstr(0, &path)) < 0 ||
      argint(1, &major) < 0 ||
      argint(2, &minor) < 0 ||
@@ -444,7 +452,7 @@ sys_chdir(void)
   struct inode *ip;
   struct proc *curproc = myproc();
   
-  begin_op();
+  begin_op(0);
   if(argstr(0, &path) < 0 || (ip = namei(path)) == 0){
     end_op();
     return -1;
@@ -519,3 +527,74 @@ sys_pipe(void)
   fd[1] = fd1;
   return 0;
 }
+
+int
+sys_fsstats(void)
+{
+  struct fsstats *st;
+
+  if(argptr(0, (void*)&st, sizeof(*st)) < 0)
+    return -1;
+  *st = fsstats;
+  return 0;
+}
+
+// Read up to n entries of directory fd, with their stat
+// data, into buf.  Returns how many, 0 at the end.
+int
+sys_getdents_plus(void)
+{
+  struct file *f;
+  struct direntplus *buf;
+  int n, r;
+
+  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || n < 0)
+    return -1;
+  if(n > NDIRLIST)
+    n = NDIRLIST;    // also keeps n*sizeof(*buf) from overflowing
+  if(argptr(1, (void*)&buf, n*sizeof(*buf)) < 0)
+    return -1;
+  if(f->type != FD_INODE || f->readable == 0)
+    return -1;
+  begin_op(0);
+  // As in fileread(): f->off is shared if f is.
+  r = dirlist(f->ip, &f->off, buf, n, f->ref > 1);
+  end_op();
+  return r;
+}
+
+// Group the following FS system calls into one log transaction,
+// committed together at fs_txn_end().
+int
+sys_fs_txn_begin(void)
+{
+  return txn_begin();
+}
+
+int
+sys_fs_txn_end(void)
+{
+  return txn_end();
+}
+
+// Wait until all finished FS system calls are committed.
+int
+sys_sync(void)
+{
+  idelaysyncall();
+  return log_sync();
+}
+
+// Wait until fd's file is committed. Transactions are not
+// tracked per file, so this commits everything, like sync().
+int
+sys_fsync(void)
+{
+  struct file *f;
+
+  if(argfd(0, 0, &f) < 0)
+    return -1;
+  if(f->type == FD_INODE && f->ip->type == T_FILE)
+    idelaysync(f->ip);
+  return log_sync();
+}
@@ -16,7 +16,7 @@ static void create_home_directory (char* username, uint uid) {
   path[0] = '/';
   strncpy(&path[1], username, USERNAME_MAXLEN);
 
-  begin_op();
+  begin_op(CREATEBLOCKS);
   struct inode *ip = create(path, T_DIR, 0, 0);
 
   if (ip == 0) {
@@ -42,7 +42,7 @@ static void set_cwd_as_home_directory (char *username) {
     path[1] = '\0';
   }
 
-  begin_op();
+  begin_op(0);
   struct inode *ip = namei(path);
   struct proc* curproc = myproc();
 
@@ -1,5 +1,7 @@
 struct stat;
 struct rtcdate;
+struct fsstats;
+struct direntplus;
 
 // system calls
 int fork(void);
@@ -28,6 +30,12 @@ int login (char*, char*);
 int addUser (char*, char*);
 int deleteUser (char*);
 int chmod (char*, int);
+int fsstats(struct fsstats*);
+int fs_txn_begin(void);
+int fs_txn_end(void);
+int sync(void);
+int fsync(int);
+int getdents_plus(int, struct direntplus*, int);
 
 // ulib.c
 int stat(const char*, struct stat*);
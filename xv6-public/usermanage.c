@@ -40,7 +40,7 @@ bad:
 }
 
 void export_usertable (void) {
-    begin_op();
+    begin_op(MAXOPBLOCKS);
     ilock(utable_ip);
     write_usertable(utable_ip);
     iunlock(utable_ip);
@@ -81,7 +81,7 @@ int init_usertable (void) {
         return -1;
     }
 
-    begin_op();
+    begin_op(MAXOPBLOCKS);
     struct inode *ip = namei("/passwd");
 
     if (ip == 0) {
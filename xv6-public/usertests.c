@@ -7,6 +7,7 @@
 #include "syscall.h"
 #include "traps.h"
 #include "memlayout.h"
+#include "fsstats.h"
 
 char buf[8192];
 char name[3];
@@ -184,6 +185,14 @@ writetest(void)
   printf(stdout, "small file test ok\n");
 }
 
+// 512-byte writes in the big files test: a file of MAXFILE
+// blocks, or 8MB when blocks are so big that would not fit.
+#if BSIZE == 512
+#define NBIG MAXFILE
+#else
+#define NBIG (8*1024*1024/512)
+#endif
+
 void
 writetest1(void)
 {
@@ -197,7 +206,7 @@ writetest1(void)
     exit();
   }
 
-  for(i = 0; i < MAXFILE; i++){
+  for(i = 0; i < NBIG; i++){
     ((int*)buf)[0] = i;
     if(write(fd, buf, 512) != 512){
       printf(stdout, "error: write big file failed\n", i);
@@ -217,7 +226,7 @@ writetest1(void)
   for(;;){
     i = read(fd, buf, 512);
     if(i == 0){
-      if(n == MAXFILE - 1){
+      if(n == NBIG - 1){
         printf(stdout, "read only %d blocks from big", n);
         exit();
       }
@@ -931,6 +940,261 @@ bigdir(void)
   printf(1, "bigdir ok\n");
 }
 
+// A directory big enough to be hashed: names must stay findable
+// as buckets split, and reading it as plain dirents must still
+// show exactly the live names.
+void
+hashdir(void)
+{
+  enum { N = 400 };
+  int i, fd, n;
+  char name[5];
+  struct dirent de;
+
+  printf(1, "hashdir test\n");
+
+  if(mkdir("hd") < 0 || chdir("hd") < 0){
+    printf(1, "hashdir: mkdir failed\n");
+    exit();
+  }
+  fd = open("f", O_CREATE);
+  close(fd);
+  name[0] = 'h';
+  name[4] = 0;
+  for(i = 0; i < N; i++){
+    name[1] = '0' + i/100;
+    name[2] = '0' + (i/10)%10;
+    name[3] = '0' + i%10;
+    if(link("f", name) != 0){
+      printf(1, "hashdir: link %s failed\n", name);
+      exit();
+    }
+  }
+  for(i = 0; i < N; i += 2){
+    name[1] = '0' + i/100;
+    name[2] = '0' + (i/10)%10;
+    name[3] = '0' + i%10;
+    if(unlink(name) != 0){
+      printf(1, "hashdir: unlink %s failed\n", name);
+      exit();
+    }
+  }
+  for(i = 0; i < N; i++){
+    name[1] = '0' + i/100;
+    name[2] = '0' + (i/10)%10;
+    name[3] = '0' + i%10;
+    fd = open(name, 0);
+    if((fd >= 0) != (i % 2 == 1)){
+      printf(1, "hashdir: %s %s\n", name, fd >= 0 ? "not removed" : "lost");
+      exit();
+    }
+    close(fd);
+  }
+
+  // ".", "..", "f" and the odd-numbered names
+  n = 0;
+  fd = open(".", 0);
+  while(read(fd, &de, sizeof(de)) == sizeof(de))
+    if(de.inum != 0)
+      n++;
+  close(fd);
+  if(n != 3 + N/2){
+    printf(1, "hashdir: read %d entries, want %d\n", n, 3 + N/2);
+    exit();
+  }
+
+  for(i = 1; i < N; i += 2){
+    name[1] = '0' + i/100;
+    name[2] = '0' + (i/10)%10;
+    name[3] = '0' + i%10;
+    unlink(name);
+  }
+  unlink("f");
+  chdir("..");
+  if(unlink("hd") != 0){
+    printf(1, "hashdir: rmdir failed\n");
+    exit();
+  }
+  printf(1, "hashdir ok\n");
+}
+
+// The name cache must forget names that are removed, learn
+// names that are created after a failed lookup, and not carry
+// names over to a new directory that reuses a removed one's inode.
+void
+namecache(void)
+{
+  struct fsstats st0, st;
+  int fd, i;
+
+  printf(1, "namecache test\n");
+
+  if(mkdir("nc") < 0){
+    printf(1, "namecache: mkdir failed\n");
+    exit();
+  }
+  if(open("nc/x", 0) >= 0){
+    printf(1, "namecache: found nc/x before creating it\n");
+    exit();
+  }
+  fd = open("nc/x", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf(1, "namecache: create failed\n");
+    exit();
+  }
+  close(fd);
+
+  fsstats(&st0);
+  for(i = 0; i < 10; i++){
+    if((fd = open("nc/x", 0)) < 0){
+      printf(1, "namecache: open nc/x failed\n");
+      exit();
+    }
+    close(fd);
+  }
+  fsstats(&st);
+  if(st.dchits - st0.dchits + st.fastlookups - st0.fastlookups < 10){
+    printf(1, "namecache: only %d hits\n", st.dchits - st0.dchits);
+    exit();
+  }
+  if(st.fastlookups == st0.fastlookups){
+    printf(1, "namecache: no lock-free lookups\n");
+    exit();
+  }
+
+  if(link("nc/x", "nc/y") != 0 || (fd = open("nc/y", 0)) < 0){
+    printf(1, "namecache: link failed\n");
+    exit();
+  }
+  close(fd);
+  if(unlink("nc/x") != 0 || unlink("nc/y") != 0){
+    printf(1, "namecache: unlink failed\n");
+    exit();
+  }
+  if(open("nc/x", 0) >= 0 || open("nc/y", 0) >= 0){
+    printf(1, "namecache: found an unlinked name\n");
+    exit();
+  }
+
+  // Give nc/x a cached entry again, then replace nc.
+  fd = open("nc/x", O_CREATE|O_RDWR);
+  close(fd);
+  if(unlink("nc/x") != 0 || unlink("nc") != 0 || mkdir("nc") < 0){
+    printf(1, "namecache: rmdir failed\n");
+    exit();
+  }
+  fd = open("nc/z", O_CREATE|O_RDWR);
+  close(fd);
+  if(open("nc/x", 0) >= 0){
+    printf(1, "namecache: new nc has old nc's name\n");
+    exit();
+  }
+  unlink("nc/z");
+  unlink("nc");
+  printf(1, "namecache ok\n");
+}
+
+// An inode nobody has open should stay in the inode cache,
+// so opening it again reads nothing from its block.
+void
+icacheretain(void)
+{
+  struct fsstats st0, st;
+  int fd, i;
+
+  printf(1, "icacheretain test\n");
+
+  fd = open("icr", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf(1, "icacheretain: create failed\n");
+    exit();
+  }
+  write(fd, "x", 1);
+  close(fd);
+
+  fsstats(&st0);
+  for(i = 0; i < 10; i++){
+    if((fd = open("icr", 0)) < 0){
+      printf(1, "icacheretain: open failed\n");
+      exit();
+    }
+    close(fd);
+  }
+  fsstats(&st);
+  if(st.ireads != st0.ireads){
+    printf(1, "icacheretain: %d inode reads\n", st.ireads - st0.ireads);
+    exit();
+  }
+  unlink("icr");
+  printf(1, "icacheretain ok\n");
+}
+
+// getdents_plus() must return every live entry once, in
+// batches of any size, with the same data stat() gives.
+void
+dirlistplus(void)
+{
+  enum { N = 40 };
+  struct direntplus de[5];
+  struct stat st;
+  char name[DIRSIZ+1];
+  int fd, i, n, total;
+
+  printf(1, "dirlistplus test\n");
+
+  if(mkdir("dlp") < 0 || chdir("dlp") < 0){
+    printf(1, "dirlistplus: mkdir failed\n");
+    exit();
+  }
+  name[0] = 'f';
+  name[3] = 0;
+  for(i = 0; i < N; i++){
+    name[1] = '0' + i/10;
+    name[2] = '0' + i%10;
+    if((fd = open(name, O_CREATE|O_RDWR)) < 0){
+      printf(1, "dirlistplus: create failed\n");
+      exit();
+    }
+    write(fd, name, i);
+    close(fd);
+  }
+
+  total = 0;
+  fd = open(".", 0);
+  while((n = getdents_plus(fd, de, 5)) > 0){
+    for(i = 0; i < n; i++){
+      memmove(name, de[i].name, DIRSIZ);
+      name[DIRSIZ] = 0;
+      if(stat(name, &st) < 0 || st.ino != de[i].ino ||
+         st.type != de[i].type || st.size != de[i].size ||
+         st.owner != de[i].owner){
+        printf(1, "dirlistplus: %s does not match stat\n", name);
+        exit();
+      }
+      total++;
+    }
+  }
+  close(fd);
+  if(n < 0 || total != N + 2){
+    printf(1, "dirlistplus: listed %d entries, want %d\n", total, N + 2);
+    exit();
+  }
+
+  name[0] = 'f';
+  name[3] = 0;
+  for(i = 0; i < N; i++){
+    name[1] = '0' + i/10;
+    name[2] = '0' + i%10;
+    unlink(name);
+  }
+  chdir("..");
+  if(unlink("dlp") != 0){
+    printf(1, "dirlistplus: rmdir failed\n");
+    exit();
+  }
+  printf(1, "dirlistplus ok\n");
+}
+
 void
 subdir(void)
 {
@@ -1114,13 +1378,30 @@ subdir(void)
   printf(1, "subdir ok\n");
 }
 
+// Print the log traffic since *st0 was taken.
+void
+logtraffic(char *test, struct fsstats *st0)
+{
+  struct fsstats st;
+
+  fsstats(&st);
+  printf(1, "%s: %d commits, %d log writes, %d zero records, %d installs, "
+         "%d direct writes, %d allocs, %d bitmap reads\n",
+         test, st.commits - st0->commits, st.logwrites - st0->logwrites,
+         st.zerorecs - st0->zerorecs, st.installs - st0->installs,
+         st.directwrites - st0->directwrites, st.ballocs - st0->ballocs,
+         st.bmapscans - st0->bmapscans);
+}
+
 // test writes that are larger than the log.
 void
 bigwrite(void)
 {
   int fd, sz;
+  struct fsstats st0;
 
   printf(1, "bigwrite test\n");
+  fsstats(&st0);
 
   unlink("bigwrite");
   for(sz = 499; sz < 12*512; sz += 471){
@@ -1141,15 +1422,251 @@ bigwrite(void)
     unlink("bigwrite");
   }
 
+  logtraffic("bigwrite", &st0);
   printf(1, "bigwrite ok\n");
 }
 
+// one large write, whose data blocks bypass the log;
+// then overwrite part of it in place and read it all back.
+void
+streamwrite(void)
+{
+  int fd, i, n;
+  struct fsstats st0;
+
+  printf(1, "streamwrite test\n");
+  fsstats(&st0);
+
+  unlink("streamwrite");
+  fd = open("streamwrite", O_CREATE | O_RDWR);
+  if(fd < 0){
+    printf(1, "streamwrite: create failed\n");
+    exit();
+  }
+  for(i = 0; i < sizeof(buf); i++)
+    buf[i] = i % 251;
+  if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+    printf(1, "streamwrite: write failed\n");
+    exit();
+  }
+  close(fd);
+
+  fd = open("streamwrite", O_RDWR);
+  memset(buf, 'x', 4000);
+  if(write(fd, buf, 4000) != 4000){
+    printf(1, "streamwrite: overwrite failed\n");
+    exit();
+  }
+  close(fd);
+
+  fd = open("streamwrite", 0);
+  if(fd < 0){
+    printf(1, "streamwrite: open failed\n");
+    exit();
+  }
+  memset(buf, 0, sizeof(buf));
+  n = read(fd, buf, sizeof(buf));
+  if(n != sizeof(buf)){
+    printf(1, "streamwrite: read %d\n", n);
+    exit();
+  }
+  for(i = 0; i < sizeof(buf); i++){
+    if(buf[i] != (i < 4000 ? 'x' : (char)(i % 251))){
+      printf(1, "streamwrite: wrong data at %d\n", i);
+      exit();
+    }
+  }
+  close(fd);
+  unlink("streamwrite");
+
+  logtraffic("streamwrite", &st0);
+  printf(1, "streamwrite ok\n");
+}
+
+// small appends, whose blocks get disk blocks only later:
+// read them back before and after fsync() and close(), and
+// unlink a file that still has some.
+void
+delaywrite(void)
+{
+  enum { N = 100, SZ = 100 };  // 20 blocks, so past NDIRECT
+  int fd, fd1, i, j, n;
+  struct fsstats st0, st;
+
+  printf(1, "delaywrite test\n");
+  fsstats(&st0);
+
+  unlink("delaywrite");
+  fd = open("delaywrite", O_CREATE | O_RDWR);
+  fd1 = open("delaywrite", 0);
+  if(fd < 0 || fd1 < 0){
+    printf(1, "delaywrite: create failed\n");
+    exit();
+  }
+  for(i = 0; i < N; i++){
+    memset(buf, 'a' + i%26, SZ);
+    if(write(fd, buf, SZ) != SZ){
+      printf(1, "delaywrite: write %d failed\n", i);
+      exit();
+    }
+    if(i == N/2 && fsync(fd) != 0){
+      printf(1, "delaywrite: fsync failed\n");
+      exit();
+    }
+    // read each write back through the other descriptor
+    if(read(fd1, buf, SZ) != SZ || buf[0] != 'a' + i%26 ||
+       buf[SZ-1] != 'a' + i%26){
+      printf(1, "delaywrite: read %d failed\n", i);
+      exit();
+    }
+  }
+  close(fd1);
+  close(fd);
+
+  fd = open("delaywrite", 0);
+  for(i = 0; i < N; i++){
+    if((n = read(fd, buf, SZ)) != SZ){
+      printf(1, "delaywrite: reread %d got %d\n", i, n);
+      exit();
+    }
+    for(j = 0; j < SZ; j++){
+      if(buf[j] != 'a' + i%26){
+        printf(1, "delaywrite: wrong data in write %d\n", i);
+        exit();
+      }
+    }
+  }
+  if(read(fd, buf, 1) != 0){
+    printf(1, "delaywrite: file too long\n");
+    exit();
+  }
+  close(fd);
+
+  // delayed blocks of an unlinked file are just dropped
+  fd = open("delaywrite", O_RDWR);
+  if(fd < 0 || read(fd, buf, N*SZ) != N*SZ){
+    printf(1, "delaywrite: reopen failed\n");
+    exit();
+  }
+  for(i = 0; i < 10; i++)
+    write(fd, buf, SZ);
+  unlink("delaywrite");
+  close(fd);
+
+  fsstats(&st);
+  printf(1, "delaywrite: %d blocks allocated late, %d goal misses\n",
+         st.delayed - st0.delayed, st.goalmisses - st0.goalmisses);
+  printf(1, "delaywrite ok\n");
+}
+
+// Two files written a block at a time in turn, with an fsync
+// after each block, so neither gets contiguous blocks and each
+// needs many extents.
+void
+extentfile(void)
+{
+  enum { N = 60 };
+  char *names[2] = { "extent0", "extent1" };
+  int fd[2], i, f;
+
+  printf(1, "extentfile test\n");
+
+  for(f = 0; f < 2; f++){
+    unlink(names[f]);
+    if((fd[f] = open(names[f], O_CREATE | O_RDWR)) < 0){
+      printf(1, "extentfile: create failed\n");
+      exit();
+    }
+  }
+  for(i = 0; i < N; i++){
+    for(f = 0; f < 2; f++){
+      memset(buf, i + f*N, 512);
+      if(write(fd[f], buf, 512) != 512 || fsync(fd[f]) != 0){
+        printf(1, "extentfile: write %d failed\n", i);
+        exit();
+      }
+    }
+  }
+  for(f = 0; f < 2; f++)
+    close(fd[f]);
+
+  for(f = 0; f < 2; f++){
+    fd[f] = open(names[f], 0);
+    for(i = 0; i < N; i++){
+      if(read(fd[f], buf, 512) != 512 || buf[0] != (char)(i + f*N) ||
+         buf[511] != (char)(i + f*N)){
+        printf(1, "extentfile: wrong data in %s block %d\n", names[f], i);
+        exit();
+      }
+    }
+    close(fd[f]);
+    unlink(names[f]);
+  }
+  printf(1, "extentfile ok\n");
+}
+
+// A file small enough to live in its inode, grown a few bytes
+// at a time until it needs a block, then rewritten in place.
+void
+inlinefile(void)
+{
+  enum { N = 100 };
+  int fd, i;
+
+  printf(1, "inlinefile test\n");
+
+  unlink("inlinefile");
+  fd = open("inlinefile", O_CREATE | O_RDWR);
+  if(fd < 0){
+    printf(1, "inlinefile: create failed\n");
+    exit();
+  }
+  for(i = 0; i < N; i += 7){
+    memset(buf, 'a' + i%26, 7);
+    if(write(fd, buf, 7) != 7){
+      printf(1, "inlinefile: write %d failed\n", i);
+      exit();
+    }
+  }
+  close(fd);
+
+  fd = open("inlinefile", 0);
+  if(read(fd, buf, sizeof(buf)) != (N+6)/7*7){
+    printf(1, "inlinefile: wrong size\n");
+    exit();
+  }
+  for(i = 0; i < (N+6)/7*7; i++){
+    if(buf[i] != 'a' + (i/7*7)%26){
+      printf(1, "inlinefile: wrong data at %d\n", i);
+      exit();
+    }
+  }
+  close(fd);
+
+  fd = open("inlinefile", O_CREATE | O_RDWR);
+  if(write(fd, "xyz", 3) != 3){
+    printf(1, "inlinefile: rewrite failed\n");
+    exit();
+  }
+  close(fd);
+  fd = open("inlinefile", 0);
+  if(read(fd, buf, 3) != 3 || buf[0] != 'x' || buf[2] != 'z'){
+    printf(1, "inlinefile: reread failed\n");
+    exit();
+  }
+  close(fd);
+  unlink("inlinefile");
+  printf(1, "inlinefile ok\n");
+}
+
 void
 bigfile(void)
 {
   int fd, i, total, cc;
+  struct fsstats st0;
 
   printf(1, "bigfile test\n");
+  fsstats(&st0);
 
   unlink("bigfile");
   fd = open("bigfile", O_CREATE | O_RDWR);
@@ -1197,6 +1714,7 @@ bigfile(void)
   }
   unlink("bigfile");
 
+  logtraffic("bigfile", &st0);
   printf(1, "bigfile test ok\n");
 }
 
@@ -1649,8 +2167,10 @@ fsfull()
 {
   int nfiles;
   int fsblocks = 0;
+  struct fsstats st0;
 
   printf(1, "fsfull test\n");
+  fsstats(&st0);
 
   for(nfiles = 0; ; nfiles++){
     char name[64];
@@ -1692,6 +2212,7 @@ fsfull()
     nfiles--;
   }
 
+  logtraffic("fsfull", &st0);
   printf(1, "fsfull test finished\n");
 }
 
@@ -1787,6 +2308,10 @@ main(int argc, char *argv[])
   rmdot();
   fourteen();
   bigfile();
+  streamwrite();
+  delaywrite();
+  extentfile();
+  inlinefile();
   subdir();
   linktest();
   unlinkread();
@@ -1794,6 +2319,10 @@ main(int argc, char *argv[])
   iref();
   forktest();
   bigdir(); // slow
+  hashdir();
+  namecache();
+  icacheretain();
+  dirlistplus();
 
   uio();
 
@@ -0,0 +1,200 @@
+// Driver for a legacy virtio-blk PCI disk.
+//
+// Unlike the IDE controller, virtio accepts many requests at once:
+// each process calling virtiorw() takes a request slot, posts it on
+// the ring and sleeps; the interrupt handler completes whichever
+// requests the device has finished, in any order.  Up to NDISKREQ
+// requests can be outstanding.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "proc.h"
+#include "x86.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "buf.h"
+#include "pci.h"
+#include "virtio.h"
+
+#define SECTOR_SIZE  512
+#define QMAX         1024  // largest ring the device may ask for
+
+// One in-flight request.  Slot i owns descriptors 3i .. 3i+2.
+struct vreq {
+  struct virtio_blk_req hdr;
+  uchar status;
+  struct buf *b;     // 0 if the slot is free
+};
+
+static struct {
+  struct spinlock lock;
+  ushort base;       // I/O port of BAR0
+  int irq;
+  int qsize;         // ring size chosen by the device
+  int depth;         // usable request slots
+  uint nsectors;
+  struct vring_desc *desc;
+  struct vring_avail *avail;
+  struct vring_used *used;
+  ushort usedidx;    // next used entry we have not looked at
+  struct vreq req[NDISKREQ];
+} vdisk;
+
+// Ring memory must be physically contiguous and page aligned.
+static char vring[PGROUNDUP(16*QMAX + 6 + 2*QMAX) + PGROUNDUP(6 + 8*QMAX)]
+  __attribute__((aligned(PGSIZE)));
+
+int havevirtio;
+
+void
+virtioinit(void)
+{
+  struct pcidev *d;
+  ushort base;
+  int q;
+
+  if((d = pcifind(VIRTIO_VENDOR, VIRTIO_DEV_BLK)) == 0)
+    return;
+  if((d->bar[0] & 1) == 0)
+    return;
+  base = PCI_BAR_IO(d->bar[0]);
+  pcienable(d);
+
+  // Reset, then announce a driver.  We need no optional features.
+  outb(base + VIRTIO_STATUS, 0);
+  outb(base + VIRTIO_STATUS, VIRTIO_ST_ACK);
+  outb(base + VIRTIO_STATUS, VIRTIO_ST_ACK | VIRTIO_ST_DRIVER);
+  inl(base + VIRTIO_HOST_FEATURES);
+  outl(base + VIRTIO_GUEST_FEATURES, 0);
+
+  outw(base + VIRTIO_QUEUE_SEL, 0);
+  q = inw(base + VIRTIO_QUEUE_SIZE);
+  if(q == 0 || q > QMAX){
+    cprintf("virtio: unusable queue size %d\n", q);
+    outb(base + VIRTIO_STATUS, VIRTIO_ST_FAILED);
+    return;
+  }
+
+  initlock(&vdisk.lock, "virtio");
+  vdisk.base = base;
+  vdisk.irq = d->irq;
+  vdisk.qsize = q;
+  vdisk.depth = q/3 < NDISKREQ ? q/3 : NDISKREQ;
+  vdisk.nsectors = inl(base + VIRTIO_BLK_CAPACITY);
+  vdisk.desc = (struct vring_desc*)vring;
+  vdisk.avail = (struct vring_avail*)(vring + 16*q);
+  vdisk.used = (struct vring_used*)(vring + PGROUNDUP(16*q + 6 + 2*q));
+  memset(vring, 0, sizeof(vring));
+  outl(base + VIRTIO_QUEUE_PFN, V2P(vring) >> 12);
+
+  outb(base + VIRTIO_STATUS,
+       VIRTIO_ST_ACK | VIRTIO_ST_DRIVER | VIRTIO_ST_DRIVER_OK);
+  havevirtio = 1;     // virtiointr() must claim the line once enabled
+  ioapicenablepci(vdisk.irq, ncpu - 1);
+  cprintf("virtio: blk at port 0x%x irq %d, %d sectors, ring %d, depth %d\n",
+          base, vdisk.irq, vdisk.nsectors, q, vdisk.depth);
+}
+
+// Handle an interrupt on line irq.  Returns 0 if it was not ours.
+int
+virtiointr(int irq)
+{
+  struct vreq *r;
+  struct buf *b;
+  int id;
+
+  if(!havevirtio || irq != vdisk.irq)
+    return 0;
+
+  acquire(&vdisk.lock);
+  inb(vdisk.base + VIRTIO_ISR);  // acknowledge; deasserts the line
+
+  while(vdisk.usedidx != vdisk.used->idx){
+    __sync_synchronize();
+    id = vdisk.used->ring[vdisk.usedidx % vdisk.qsize].id;
+    r = &vdisk.req[id / 3];
+    if(r->status != 0)
+      panic("virtio: request failed");
+    b = r->b;
+    b->flags |= B_VALID;
+    b->flags &= ~B_DIRTY;
+    r->b = 0;
+    wakeup(b);
+    vdisk.usedidx++;
+  }
+  wakeup(&vdisk.req);  // slots are free again
+  release(&vdisk.lock);
+  return 1;
+}
+
+// Sync buf with disk, like iderw().
+// If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
+// Else if B_VALID is not set, read buf from disk, set B_VALID.
+void
+virtiorw(struct buf *b)
+{
+  struct vring_desc *d;
+  struct vreq *r;
+  uint sector;
+  int i, write;
+
+  if(!holdingsleep(&b->lock))
+    panic("virtiorw: buf not locked");
+  if((b->flags & (B_VALID|B_DIRTY)) == B_VALID)
+    panic("virtiorw: nothing to do");
+  sector = b->blockno * (BSIZE/SECTOR_SIZE);
+  if(sector + BSIZE/SECTOR_SIZE > vdisk.nsectors)
+    panic("virtiorw: blockno");
+  write = (b->flags & B_DIRTY) != 0;
+
+  acquire(&vdisk.lock);
+
+  // Wait for a free request slot.
+  for(;;){
+    for(i = 0; i < vdisk.depth; i++)
+      if(vdisk.req[i].b == 0)
+        break;
+    if(i < vdisk.depth)
+      break;
+    sleep(&vdisk.req, &vdisk.lock);
+  }
+
+  r = &vdisk.req[i];
+  r->b = b;
+  r->status = 0xff;
+  r->hdr.type = write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+  r->hdr.reserved = 0;
+  r->hdr.sector = sector;
+  r->hdr.sectorhi = 0;
+
+  d = &vdisk.desc[3*i];
+  d[0].addr = V2P(&r->hdr);
+  d[0].len = sizeof(r->hdr);
+  d[0].flags = VRING_DESC_F_NEXT;
+  d[0].next = 3*i + 1;
+  d[1].addr = V2P(b->data);
+  d[1].len = BSIZE;
+  d[1].flags = VRING_DESC_F_NEXT | (write ? 0 : VRING_DESC_F_WRITE);
+  d[1].next = 3*i + 2;
+  d[2].addr = V2P(&r->status);
+  d[2].len = 1;
+  d[2].flags = VRING_DESC_F_WRITE;
+  d[2].next = 0;
+
+  // Publish the chain, then the new index, then tell the device.
+  vdisk.avail->ring[vdisk.avail->idx % vdisk.qsize] = 3*i;
+  __sync_synchronize();
+  vdisk.avail->idx++;
+  __sync_synchronize();
+  outw(vdisk.base + VIRTIO_QUEUE_NOTIFY, 0);
+
+  // Wait for request to finish.
+  while(r->b == b)
+    sleep(b, &vdisk.lock);
+
+  release(&vdisk.lock);
+}
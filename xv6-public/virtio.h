@@ -0,0 +1,65 @@
+// Legacy ("transitional") virtio-blk device over PCI.
+// See the virtio 0.9.5 specification.
+
+#define VIRTIO_VENDOR        0x1af4
+#define VIRTIO_DEV_BLK       0x1001
+
+// Registers in the I/O space of BAR0.
+#define VIRTIO_HOST_FEATURES 0x00  // 32-bit
+#define VIRTIO_GUEST_FEATURES 0x04 // 32-bit
+#define VIRTIO_QUEUE_PFN     0x08  // 32-bit physical page number of ring
+#define VIRTIO_QUEUE_SIZE    0x0c  // 16-bit, read-only
+#define VIRTIO_QUEUE_SEL     0x0e  // 16-bit
+#define VIRTIO_QUEUE_NOTIFY  0x10  // 16-bit
+#define VIRTIO_STATUS        0x12  // 8-bit
+#define VIRTIO_ISR           0x13  // 8-bit, read to acknowledge
+#define VIRTIO_BLK_CAPACITY  0x14  // 64-bit, in 512-byte sectors
+
+// Device status bits.
+#define VIRTIO_ST_ACK        1
+#define VIRTIO_ST_DRIVER     2
+#define VIRTIO_ST_DRIVER_OK  4
+#define VIRTIO_ST_FAILED     128
+
+// A legacy ring: descriptors, then the available ring,
+// then (page aligned) the used ring.
+#define VRING_ALIGN          4096
+
+struct vring_desc {
+  uint addr;       // physical address (low 32 bits)
+  uint addrhi;
+  uint len;
+  ushort flags;
+  ushort next;
+};
+#define VRING_DESC_F_NEXT    1  // chained with another descriptor
+#define VRING_DESC_F_WRITE   2  // device writes (vs reads)
+
+struct vring_avail {
+  ushort flags;
+  ushort idx;
+  ushort ring[];
+};
+
+struct vring_used_elem {
+  uint id;         // index of start of completed descriptor chain
+  uint len;
+};
+
+struct vring_used {
+  ushort flags;
+  ushort idx;
+  struct vring_used_elem ring[];
+};
+
+// Every block request is a three-descriptor chain:
+// header (device reads), data, status byte (device writes).
+#define VIRTIO_BLK_T_IN      0  // read
+#define VIRTIO_BLK_T_OUT     1  // write
+
+struct virtio_blk_req {
+  uint type;
+  uint reserved;
+  uint sector;
+  uint sectorhi;
+};
@@ -0,0 +1,82 @@
+// Large-write benchmark: fill files with small writes, which go
+// through the log a few blocks per transaction, and then with
+// large ones, which stream their data blocks around the log.
+//
+//   writebench [nfiles]
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+#include "fsstats.h"
+
+#define FILESIZE  (64*1024)  // fits in one file (MAXFILE)
+#define SMALL     1024       // bytes per write, logged
+#define LARGE     (32*1024)  // bytes per write, streamed
+
+char buf[LARGE];
+
+void
+fname(char *p, int i)
+{
+  p[0] = 'w';
+  p[1] = 'b';
+  p[2] = '0' + i/10;
+  p[3] = '0' + i%10;
+  p[4] = 0;
+}
+
+void
+run(int nfiles, int wsize)
+{
+  struct fsstats st0, st;
+  char name[5];
+  int i, n, fd, start, t;
+
+  fsstats(&st0);
+  start = uptime();
+  for(i = 0; i < nfiles; i++){
+    fname(name, i);
+    unlink(name);
+    if((fd = open(name, O_CREATE | O_RDWR)) < 0){
+      printf(1, "writebench: create %s failed\n", name);
+      exit();
+    }
+    for(n = 0; n < FILESIZE; n += wsize){
+      buf[0] = i;
+      if(write(fd, buf, wsize) != wsize){
+        printf(1, "writebench: write %s failed\n", name);
+        exit();
+      }
+    }
+    close(fd);
+  }
+  t = uptime() - start;
+  fsstats(&st);
+
+  printf(1, "%d-byte writes: %d KB in %d ticks, %d commits, "
+         "%d log writes, %d direct writes\n",
+         wsize, nfiles * FILESIZE / 1024, t, st.commits - st0.commits,
+         st.logwrites - st0.logwrites, st.directwrites - st0.directwrites);
+
+  for(i = 0; i < nfiles; i++){
+    fname(name, i);
+    unlink(name);
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  int nfiles;
+
+  nfiles = argc > 1 ? atoi(argv[1]) : 4;
+  if(nfiles < 1 || nfiles > 99){
+    printf(1, "usage: writebench [nfiles]\n");
+    exit();
+  }
+  memset(buf, 'w', sizeof(buf));
+  run(nfiles, SMALL);
+  run(nfiles, LARGE);
+  exit();
+}